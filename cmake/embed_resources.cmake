@@ -0,0 +1,39 @@
+# Turns files into the byte arrays and EMBEDDED_FILES table that
+# src/io/embedded.h declares, in one translation unit.
+#   cmake -DROOT=<dir> -DFILES=<a|b|c> [-DCOOKED_ROOT=<dir> -DCOOKED=<d|e>]
+#         -DOUTPUT=<source> -P embed_resources.cmake
+# ROOT is src/; FILES are paths relative to it and become the lookup names.
+# COOKED are textures cooked at build time, relative to COOKED_ROOT.
+
+string(REPLACE "|" ";" FILES "${FILES}")
+string(REPLACE "|" ";" COOKED "${COOKED}")
+set(paths "")
+foreach (name ${FILES})
+    list(APPEND paths "${ROOT}/${name}")
+endforeach ()
+foreach (name ${COOKED})
+    list(APPEND FILES "${name}")
+    list(APPEND paths "${COOKED_ROOT}/${name}")
+endforeach ()
+set(arrays "")
+set(table "")
+set(index 0)
+foreach (name ${FILES})
+    list(GET paths ${index} path)
+    file(READ "${path}" hex HEX)
+    string(LENGTH "${hex}" length)
+    math(EXPR size "${length} / 2")
+    if (size EQUAL 0)
+        set(bytes "0")
+    else ()
+        string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    endif ()
+    string(APPEND arrays "static const unsigned char embedded_${index}[] = {${bytes}};\n")
+    string(APPEND table "        {\"${name}\", embedded_${index}, ${size}},\n")
+    math(EXPR index "${index} + 1")
+endforeach ()
+
+set(content "// generated by cmake/embed_resources.cmake, do not edit\n#include \"${ROOT}/io/embedded.h\"\n\n")
+string(APPEND content "${arrays}\nconst EmbeddedFile EMBEDDED_FILES[] = {\n${table}        {nullptr, nullptr, 0}\n};\n")
+
+file(WRITE "${OUTPUT}" "${content}")
@@ -6,19 +6,30 @@
 
 using namespace glm;
 
+// Position and angles only, cheap to copy between threads.
+struct FPSCameraState {
+    vec3 pos;
+    float yaw;
+    float pitch;
+};
+
 class FPSCamera {
 private:
     vec3 m_pos;
     float m_pitch = 0, m_yaw = 0;
 
+    static void basis(float yaw, float pitch, vec3 &x, vec3 &y, vec3 &z) {
+        float cosYaw = cos(yaw);
+        float sinYaw = sin(yaw);
+        float cosPitch = cos(pitch);
+        float sinPitch = sin(pitch);
+        x = vec3(cosYaw, 0, -sinYaw);
+        y = vec3(sinPitch * sinYaw, cosPitch, sinPitch * cosYaw);
+        z = vec3(cosPitch * sinYaw, -sinPitch, cosPitch * cosYaw);
+    }
+
     void recalc_basis() {
-        float cosYaw = cos(m_yaw);
-        float sinYaw = sin(m_yaw);
-        float cosPitch = cos(m_pitch);
-        float sinPitch = sin(m_pitch);
-        xaxis = vec3(cosYaw, 0, -sinYaw);
-        yaxis = vec3(sinPitch * sinYaw, cosPitch, sinPitch * cosYaw);
-        zaxis = vec3(cosPitch * sinYaw, -sinPitch, cosPitch * cosYaw);
+        basis(m_yaw, m_pitch, xaxis, yaxis, zaxis);
     }
 
 public:
@@ -31,11 +42,21 @@ public:
     }
 
     mat4 view() {
+        return view(state());
+    }
+
+    FPSCameraState state() const {
+        return FPSCameraState{m_pos, m_yaw, m_pitch};
+    }
+
+    static mat4 view(const FPSCameraState &state) {
+        vec3 xaxis, yaxis, zaxis;
+        basis(state.yaw, state.pitch, xaxis, yaxis, zaxis);
         mat4 inv_trans = {
                 vec4(1, 0, 0, 0),
                 vec4(0, 1, 0, 0),
                 vec4(0, 0, 1, 0),
-                vec4(-m_pos.x, -m_pos.y, -m_pos.z, 1)
+                vec4(-state.pos.x, -state.pos.y, -state.pos.z, 1)
         };
         mat4 inv_rot = {
                 vec4(xaxis.x, yaxis.x, zaxis.x, 0),
@@ -0,0 +1,142 @@
+#ifndef CG_CAMERA_INPUT_H
+#define CG_CAMERA_INPUT_H
+
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "camera/fps_camera.h"
+#include "fps_camera_controller.h"
+#include "camera/arcball_camera.h"
+#include "arcball_camera_controller.h"
+#include "threading/seqlock.h"
+#include "profiling/trace.h"
+
+// keys integrated every input tick while held
+const int TRACKABLE_KEYS[] = {
+        GLFW_KEY_W,
+        GLFW_KEY_A,
+        GLFW_KEY_S,
+        GLFW_KEY_D,
+        GLFW_KEY_Q,
+        GLFW_KEY_E,
+        GLFW_KEY_Z,
+        GLFW_KEY_C,
+        GLFW_KEY_SPACE,
+        GLFW_KEY_LEFT_SHIFT
+};
+
+// What the renderer needs from the cameras, stamped with the input tick
+// that produced it and the earliest input event it reflects (0 before the
+// first input).
+struct CameraSnapshot {
+    FPSCameraState fps;
+    double time;
+    double input_time;
+};
+
+// Cameras driven by the mouse and keyboard, owned by the event thread.
+// Callbacks only accumulate; update() applies everything that arrived
+// since the last tick at once and publishes the result.
+class CameraInput {
+public:
+    SeqLock<CameraSnapshot> snapshot;
+
+    CameraInput(int width, int height) : width(width),
+                                         height(height),
+                                         fps_camera(vec3(0, 0, 3)),
+                                         fps_controller(&fps_camera),
+                                         arcball_camera(identity<quat>(), vec3(0, 0, 0), vec3(0, 0, 5)),
+                                         arcball_controller(&arcball_camera, this->width, this->height) {
+        snapshot.store(CameraSnapshot{fps_camera.state(), 0, 0});
+    }
+
+    void mouse_move(double x, double y) {
+        if (first_mouse) {
+            first_mouse = false;
+            mouse_x = x;
+            mouse_y = y;
+        }
+        mouse_dx += x - mouse_x;
+        mouse_dy += y - mouse_y;
+        mouse_x = x;
+        mouse_y = y;
+        mouse_moved = true;
+        stamp();
+    }
+
+    // the cursor was elsewhere (the overlay had it); the next move is not a delta
+    void recenter() {
+        first_mouse = true;
+    }
+
+    void mouse_button(int button, int action, int mods) {
+        arcball_controller.mouseButton(button, action, mods, mouse_x, mouse_y);
+        stamp();
+    }
+
+    void scroll(double x, double y) {
+        scroll_x += x;
+        scroll_y += y;
+        stamp();
+    }
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+    }
+
+    // held: bit i set while TRACKABLE_KEYS[i] is down; true if any input
+    // reached the cameras
+    bool update(unsigned held, float dt, double time) {
+        TRACE_ZONE("camera input");
+        if (mouse_moved) {
+            // controllers take whole pixels; keep the remainder for later
+            int dx = (int) mouse_dx;
+            int dy = (int) mouse_dy;
+            mouse_dx -= dx;
+            mouse_dy -= dy;
+            fps_controller.process_mouse(dx, dy);
+            arcball_controller.mouseMove(mouse_x, mouse_y);
+            mouse_moved = false;
+        }
+        if (scroll_x != 0 || scroll_y != 0) {
+            arcball_controller.mouseScroll(scroll_x, scroll_y);
+            scroll_x = scroll_y = 0;
+        }
+        for (size_t i = 0; i < sizeof(TRACKABLE_KEYS) / sizeof(int); i++)
+            if (held & (1u << i))
+                fps_controller.processKey(TRACKABLE_KEYS[i], dt);
+        // held keys are sampled by this tick
+        if (held && event_time == 0)
+            event_time = time;
+        bool changed = event_time != 0;
+        if (changed) {
+            input_time = event_time;
+            event_time = 0;
+        }
+        snapshot.store(CameraSnapshot{fps_camera.state(), time, input_time});
+        return changed;
+    }
+
+private:
+    int width, height;
+    FPSCamera fps_camera;
+    FPSCameraController fps_controller;
+    ArcballCamera arcball_camera;
+    ArcballCameraController arcball_controller;
+    double mouse_x = 0, mouse_y = 0;
+    double mouse_dx = 0, mouse_dy = 0;
+    double scroll_x = 0, scroll_y = 0;
+    bool mouse_moved = false;
+    bool first_mouse = true;
+    // earliest event since the last tick, and the one last published
+    double event_time = 0;
+    double input_time = 0;
+
+    void stamp() {
+        if (event_time == 0)
+            event_time = glfwGetTime();
+    }
+};
+
+#endif //CG_CAMERA_INPUT_H
@@ -0,0 +1,133 @@
+#ifndef CG_FRAME_PACER_H
+#define CG_FRAME_PACER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "profiling/trace.h"
+#include "log/logger.h"
+
+// Keeps the CPU at most max_in_flight frames ahead of the GPU by fencing
+// every swap and waiting for the oldest fence before starting a frame,
+// so the driver cannot queue up latency under load. Optionally caps the
+// frame rate by sleeping precisely to a target frame time.
+class FramePacer {
+public:
+    // on the thread that will call begin_frame()
+    FramePacer(int max_in_flight, double target_fps) : fences(std::max(1, max_in_flight), nullptr),
+                                                       frame_time(target_fps > 0 ? 1.0 / target_fps : 0) {
+#ifdef __linux__
+        // the default 50 us of timer slack is added to every limiter wakeup
+        if (frame_time > 0)
+            prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+#endif
+    }
+
+    // Sets the swap interval on the current context; -1 asks for adaptive
+    // vsync and drops to 1 where tearing swaps are unsupported.
+    static void set_swap_interval(int interval) {
+        if (interval < 0 && !glfwExtensionSupported("GLX_EXT_swap_control_tear")
+            && !glfwExtensionSupported("WGL_EXT_swap_control_tear")) {
+            LOG_WARNING("adaptive vsync unsupported, using swap interval 1");
+            interval = 1;
+        }
+        glfwSwapInterval(interval);
+    }
+
+    // before building a frame
+    void begin_frame() {
+        TRACE_ZONE("pacer wait");
+        double start = glfwGetTime();
+        GLsync &oldest = fences[next];
+        if (oldest) {
+            while (glClientWaitSync(oldest, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(oldest);
+            oldest = nullptr;
+        }
+        double now = glfwGetTime();
+        wait_total += now - start;
+        if (frame_time > 0) {
+            if (deadline == 0 || now - deadline > frame_time)
+                deadline = now;
+            sleep_until(deadline);
+            double woke = glfwGetTime();
+            sleep_total += woke - now;
+            late_total += woke - deadline;
+            late_max = std::max(late_max, woke - deadline);
+            deadline += frame_time;
+        }
+        frames++;
+    }
+
+    // right after glfwSwapBuffers
+    void end_frame() {
+        depth_total += in_flight();
+        fences[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        next = (next + 1) % fences.size();
+    }
+
+    // frames submitted but not finished on the GPU
+    int in_flight() const {
+        int count = 0;
+        for (GLsync fence : fences) {
+            if (!fence)
+                continue;
+            GLint status = GL_SIGNALED;
+            glGetSynciv(fence, GL_SYNC_STATUS, 1, nullptr, &status);
+            if (status != GL_SIGNALED)
+                count++;
+        }
+        return count;
+    }
+
+    void print() const {
+        if (frames == 0)
+            return;
+        LOG_INFO("frames in flight: %.2f avg of %d, fence wait %.3f ms/frame, limiter sleep %.3f ms/frame",
+               (double) depth_total / frames, (int) fences.size(), 1000 * wait_total / frames,
+               1000 * sleep_total / frames);
+        if (frame_time > 0)
+            LOG_INFO("limiter wakeups late by %.1f us avg, %.1f us max", 1e6 * late_total / frames, 1e6 * late_max);
+    }
+
+    void reset() {
+        frames = 0;
+        depth_total = 0;
+        wait_total = sleep_total = 0;
+        late_total = late_max = 0;
+    }
+
+private:
+    std::vector<GLsync> fences;
+    size_t next = 0;
+    double frame_time;
+    double deadline = 0;
+    int frames = 0;
+    long long depth_total = 0;
+    double wait_total = 0, sleep_total = 0;
+    double late_total = 0, late_max = 0;
+
+    // sleeps until SPIN before the deadline, then spins the rest of the way
+    static void sleep_until(double deadline) {
+        const double SPIN = 80e-6;
+        double remaining = deadline - glfwGetTime();
+        if (remaining > SPIN) {
+            timespec target;
+            clock_gettime(CLOCK_MONOTONIC, &target);
+            long long ns = target.tv_nsec + (long long) ((remaining - SPIN) * 1e9);
+            target.tv_sec += (time_t) (ns / 1000000000);
+            target.tv_nsec = (long) (ns % 1000000000);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr) == EINTR);
+        }
+        while (glfwGetTime() < deadline);
+    }
+};
+
+#endif //CG_FRAME_PACER_H
@@ -0,0 +1,64 @@
+#ifndef CG_FRAME_PACKET_H
+#define CG_FRAME_PACKET_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+using namespace glm;
+
+// Cube of the instanced field; material indexes the renderer's materials,
+// whose texture layers are only known on the GL thread.
+// A spinning cube takes its rotation from the interpolated spin instead of
+// model.
+struct CubeState {
+    mat4 model;
+    int material;
+    bool spinning;
+};
+
+// Scene parameters tuned live from the overlay; the simulation owns them,
+// publishes them in every packet and takes changes with Simulation::tune().
+struct SceneParams {
+    // hexagon tile radius the layout was computed with
+    float hex_radius = 0;
+    // seconds per ring
+    float hex_period = 0;
+    int hex_divisions = 0;
+    // animation time, seconds since the first ring started
+    float hex_elapsed = 0;
+    // cubes of the stress field, on top of the fixed ones
+    int stress_cubes = 0;
+};
+
+// Everything the GL thread needs to draw one frame, produced by the
+// simulation thread and read-only once published. Moving state is kept for
+// the last two fixed steps, [0] at time - step and [1] at time, so the
+// renderer can draw in between at any frame rate. The camera is not part of
+// it; the renderer takes the freshest one from CameraInput.
+struct FramePacket {
+    uint64_t frame = 0;
+    double time = 0;
+    double step = 0;
+    quat spin[2]{identity<quat>(), identity<quat>()};
+    std::vector<CubeState> cubes;
+    std::vector<mat4> hex_tiles;
+    SceneParams params;
+
+    // Blend factor for a frame drawn at render_time. Drawing lags the
+    // simulation by one step, so a packet published on schedule covers the
+    // whole interval until its successor arrives.
+    float alpha(double render_time) const {
+        if (step <= 0)
+            return 1;
+        return (float) std::min(std::max((render_time - time) / step, 0.0), 1.0);
+    }
+
+    mat4 spin_model(float alpha) const {
+        return toMat4(slerp(spin[0], spin[1], alpha));
+    }
+};
+
+#endif //CG_FRAME_PACKET_H
@@ -0,0 +1,139 @@
+#ifndef CG_FRAME_SCHEDULER_H
+#define CG_FRAME_SCHEDULER_H
+
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "profiling/trace.h"
+#include "profiling/alloc_tracker.h"
+#include "log/logger.h"
+
+// Deferred GL-thread work run in slices in whatever is left of each frame's
+// budget after drawing, so heavy one-off jobs (mesh rebuilds, shader
+// relinks) spread over frames instead of causing a hitch. A task is called
+// with the slice deadline (glfwGetTime() seconds) and returns true once it
+// is finished; returning false keeps it queued to resume next frame, so a
+// long task should do bounded pieces of work, checking the deadline between
+// them, and keep its progress in its captures. Higher priorities run first,
+// equal ones in submission order. A task starved for MAX_STARVED_FRAMES
+// frames gets one slice regardless of the budget, so a busy scene cannot
+// block it forever; that slice's deadline has already passed, so a task
+// should always finish at least one piece per call.
+class FrameScheduler {
+public:
+    enum Priority {
+        LOW,
+        NORMAL,
+        HIGH,
+        PRIORITIES
+    };
+
+    static const int MAX_STARVED_FRAMES = 30;
+
+    // any thread
+    void submit(Priority priority, std::string name, std::function<bool(double deadline)> task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queues[priority].push_back(Task{std::move(name), std::move(task)});
+    }
+
+    // GL thread, after the frame is drawn: runs slices until deadline
+    void run(double deadline) {
+        double now = glfwGetTime();
+        bool forced = false;
+        if (now >= deadline) {
+            if (backlog() == 0)
+                return;
+            if (++starved < MAX_STARVED_FRAMES)
+                return;
+            forced = true;
+            stats.forced++;
+        }
+        starved = 0;
+        while (forced || now < deadline) {
+            Task task;
+            Priority priority;
+            if (!take(task, priority))
+                break;
+            bool done;
+            {
+                TRACE_ZONE("deferred task");
+                ALLOC_TAG("deferred tasks");
+                done = task.run(forced ? now : deadline);
+            }
+            double end = glfwGetTime();
+            stats.slices++;
+            if (end > deadline) {
+                stats.overruns++;
+                stats.overrun_max = std::max(stats.overrun_max, end - deadline);
+                if (end - deadline > 0.002)
+                    LOG_WARNING("deferred task '%s' overran the frame budget by %.2f ms", task.name.c_str(),
+                           1000 * (end - deadline));
+            }
+            if (done) {
+                stats.completed++;
+            } else {
+                // resumes at the front of its priority next time
+                std::lock_guard<std::mutex> lock(mutex);
+                queues[priority].push_front(std::move(task));
+            }
+            now = end;
+            forced = false;
+        }
+    }
+
+    // tasks waiting or part-way through
+    size_t backlog() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = 0;
+        for (const std::deque<Task> &queue : queues)
+            count += queue.size();
+        return count;
+    }
+
+    // slices, overruns and backlog since the last call
+    void print() {
+        size_t waiting = backlog();
+        if (stats.slices > 0 || waiting > 0)
+            LOG_INFO("deferred: %zu queued, %d slices, %d done, %d over budget (max %.2f ms), %d forced", waiting,
+                   stats.slices, stats.completed, stats.overruns, 1000 * stats.overrun_max, stats.forced);
+        stats = Stats();
+    }
+
+private:
+    struct Task {
+        std::string name;
+        std::function<bool(double)> run;
+    };
+
+    struct Stats {
+        int slices = 0;
+        int completed = 0;
+        int overruns = 0;
+        int forced = 0;
+        double overrun_max = 0;
+    };
+
+    std::mutex mutex;
+    std::deque<Task> queues[PRIORITIES];
+    int starved = 0;
+    Stats stats;
+
+    bool take(Task &task, Priority &priority) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int p = HIGH; p >= LOW; p--) {
+            if (!queues[p].empty()) {
+                task = std::move(queues[p].front());
+                queues[p].pop_front();
+                priority = (Priority) p;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif //CG_FRAME_SCHEDULER_H
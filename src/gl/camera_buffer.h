@@ -0,0 +1,111 @@
+#ifndef CG_CAMERA_BUFFER_H
+#define CG_CAMERA_BUFFER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <cstring>
+#include "../profiling/trace.h"
+#include "gpu_memory.h"
+#include "../profiling/counters.h"
+
+using namespace glm;
+
+// std140 layout of the Camera uniform block in the shaders
+struct CameraBlock {
+    mat4 view;
+    mat4 projection;
+};
+
+const GLuint CAMERA_BINDING = 0;
+
+// Ring of camera blocks in one uniform buffer. With GL 4.4 the buffer is
+// persistently mapped and each slot is fenced after the draws that read
+// it, so a slot is only rewritten once the GPU is done with it; older
+// contexts fall back to glBufferSubData. Write the camera right before the
+// draws that use it, after all other per-frame CPU work.
+class CameraBuffer {
+public:
+    static const int SLOTS = 3;
+
+    CameraBuffer() {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = (sizeof(CameraBlock) + alignment - 1) / alignment * alignment;
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        if (GLAD_GL_VERSION_4_4) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, stride * SLOTS, nullptr, flags);
+            mapped = (unsigned char *) glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * SLOTS, flags);
+        } else {
+            glBufferData(GL_UNIFORM_BUFFER, stride * SLOTS, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        GpuMemory::buffer(ubo, stride * SLOTS, GL_STREAM_DRAW, "camera");
+    }
+
+    ~CameraBuffer() {
+        for (GLsync fence : fences)
+            glDeleteSync(fence);
+        glDeleteBuffers(1, &ubo);
+        GpuMemory::release_buffer(ubo);
+    }
+
+    CameraBuffer(const CameraBuffer &) = delete;
+
+    CameraBuffer &operator=(const CameraBuffer &) = delete;
+
+    // points the Camera block of program at CAMERA_BINDING
+    static void bind_block(GLuint program) {
+        GLuint index = glGetUniformBlockIndex(program, "Camera");
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, CAMERA_BINDING);
+    }
+
+    // Fills the next slot and binds it. Blocks only if the GPU is still
+    // reading that slot from SLOTS frames ago.
+    void write(const CameraBlock &block) {
+        TRACE_ZONE("camera write");
+        slot = (slot + 1) % SLOTS;
+        if (fences[slot]) {
+            double start = glfwGetTime();
+            glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            wait_time += glfwGetTime() - start;
+            glDeleteSync(fences[slot]);
+            fences[slot] = nullptr;
+        }
+        GLintptr offset = slot * stride;
+        if (mapped) {
+            memcpy(mapped + offset, &block, sizeof(block));
+        } else {
+            glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+            glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(block), &block);
+        }
+        glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BINDING, ubo, offset, sizeof(block));
+        Counters::add(Counters::UNIFORM_BYTES, sizeof(block));
+    }
+
+    // after the last draw that reads the current slot
+    void fence() {
+        if (mapped)
+            fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // seconds spent waiting on fences since the last call
+    double take_wait_time() {
+        double time = wait_time;
+        wait_time = 0;
+        return time;
+    }
+
+private:
+    GLuint ubo = 0;
+    GLsizeiptr stride = 0;
+    unsigned char *mapped = nullptr;
+    GLsync fences[SLOTS] = {};
+    int slot = 0;
+    double wait_time = 0;
+};
+
+#endif //CG_CAMERA_BUFFER_H
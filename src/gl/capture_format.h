@@ -0,0 +1,394 @@
+#ifndef CG_CAPTURE_FORMAT_H
+#define CG_CAPTURE_FORMAT_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "../io/lz4.h"
+
+// File format shared by GLCapture and cgreplay.
+//
+// The file is a header followed by LZ4 blocks, each [raw size][compressed
+// size][bytes], that decompress to one stream of records. A record is a
+// one-byte opcode and its arguments as raw little-endian values; payloads
+// (buffer and texture data, shader sources, names) are a 32-bit size and
+// the bytes. Object names, syncs and uniform locations are stored as the
+// application saw them and remapped on replay.
+namespace capture {
+    const char MAGIC[8] = {'C', 'G', 'C', 'A', 'P', 'T', 'U', 'R'};
+    const uint32_t VERSION = 1;
+    const size_t BLOCK_SIZE = 1 << 20;
+
+    // Calls whose arguments are all plain values or names, captured and
+    // replayed generically: name, then the role of each argument.
+#define CG_GENERIC_GL_CALLS(X) \
+    X(ActiveTexture, (Value)) \
+    X(AttachShader, (ProgramName, ShaderName)) \
+    X(BindTexture, (Value, TextureName)) \
+    X(BindVertexArray, (VertexArrayName)) \
+    X(BlendFunc, (Value, Value)) \
+    X(Clear, (Value)) \
+    X(ClearColor, (Value, Value, Value, Value)) \
+    X(ClientWaitSync, (Sync, Value, Value)) \
+    X(CompileShader, (ShaderName)) \
+    X(DeleteProgram, (ProgramName)) \
+    X(DeleteShader, (ShaderName)) \
+    X(DeleteSync, (Sync)) \
+    X(Disable, (Value)) \
+    X(DrawArrays, (Value, Value, Value)) \
+    X(DrawArraysInstanced, (Value, Value, Value, Value)) \
+    X(DrawElements, (Value, Value, Value, Offset)) \
+    X(DrawElementsInstanced, (Value, Value, Value, Offset, Value)) \
+    X(Enable, (Value)) \
+    X(EnableVertexAttribArray, (Value)) \
+    X(Flush, ()) \
+    X(GetInteger64v, (Value, Out)) \
+    X(GetIntegerv, (Value, Out)) \
+    X(GetProgramInfoLog, (ProgramName, Value, Out, Out)) \
+    X(GetProgramiv, (ProgramName, Value, Out)) \
+    X(GetQueryObjectui64v, (QueryName, Value, Out)) \
+    X(GetQueryObjectuiv, (QueryName, Value, Out)) \
+    X(GetQueryiv, (Value, Value, Out)) \
+    X(GetShaderInfoLog, (ShaderName, Value, Out, Out)) \
+    X(GetShaderiv, (ShaderName, Value, Out)) \
+    X(GetSynciv, (Sync, Value, Value, Out, Out)) \
+    X(LineWidth, (Value)) \
+    X(LinkProgram, (ProgramName)) \
+    X(PolygonMode, (Value, Value)) \
+    X(QueryCounter, (QueryName, Value)) \
+    X(TexParameteri, (Value, Value, Value)) \
+    X(TexStorage2D, (Value, Value, Value, Value, Value)) \
+    X(TexStorage3D, (Value, Value, Value, Value, Value, Value)) \
+    X(Uniform1f, (Location, Value)) \
+    X(Uniform1i, (Location, Value)) \
+    X(Uniform2f, (Location, Value, Value)) \
+    X(VertexAttribDivisor, (Value, Value)) \
+    X(VertexAttribPointer, (Value, Value, Value, Value, Value, Offset)) \
+    X(Viewport, (Value, Value, Value, Value)) \
+    X(WaitSync, (Sync, Value, Value))
+
+    // Calls with names to create, pointers to data or state the capture
+    // needs to follow, each with its own hook and replay.
+#define CG_SPECIAL_GL_CALLS(X) \
+    X(BindBuffer) \
+    X(BindBufferRange) \
+    X(BufferData) \
+    X(BufferStorage) \
+    X(BufferSubData) \
+    X(CopyBufferSubData) \
+    X(CreateProgram) \
+    X(CreateShader) \
+    X(DeleteBuffers) \
+    X(DeleteQueries) \
+    X(DeleteTextures) \
+    X(DeleteVertexArrays) \
+    X(FenceSync) \
+    X(GenBuffers) \
+    X(GenQueries) \
+    X(GenTextures) \
+    X(GenVertexArrays) \
+    X(GetUniformBlockIndex) \
+    X(GetUniformLocation) \
+    X(MapBufferRange) \
+    X(PixelStorei) \
+    X(ShaderSource) \
+    X(TexImage2D) \
+    X(TexImage3D) \
+    X(TexSubImage2D) \
+    X(TexSubImage3D) \
+    X(UniformBlockBinding) \
+    X(UniformMatrix4fv) \
+    X(UseProgram)
+
+    enum Op : uint8_t {
+        // the render thread swapped buffers
+        OP_END_FRAME,
+        // following calls come from another context: [u8 context]
+        OP_CONTEXT,
+        // the application wrote into a persistently mapped buffer:
+        // [buffer][offset][payload]
+        OP_MAPPED_WRITE,
+#define CG_OP(name, ...) OP_##name,
+        CG_GENERIC_GL_CALLS(CG_OP)
+        CG_SPECIAL_GL_CALLS(CG_OP)
+#undef CG_OP
+        OP_COUNT
+    };
+
+    inline const char *op_name(int op) {
+        static const char *names[] = {
+                "<end frame>", "<context>", "<mapped write>",
+#define CG_OP_NAME(name, ...) "gl" #name,
+                CG_GENERIC_GL_CALLS(CG_OP_NAME)
+                CG_SPECIAL_GL_CALLS(CG_OP_NAME)
+#undef CG_OP_NAME
+        };
+        return op < OP_COUNT ? names[op] : "<unknown>";
+    }
+
+    // kinds of object names remapped on replay
+    enum NameKind {
+        BUFFER_NAME,
+        TEXTURE_NAME,
+        VERTEX_ARRAY_NAME,
+        QUERY_NAME,
+        PROGRAM_NAME,
+        SHADER_NAME,
+        NAME_KINDS
+    };
+
+    // Accumulates records and writes them out as LZ4 blocks. Not thread
+    // safe; GLCapture serializes access.
+    class Writer {
+    public:
+        bool open(const char *path) {
+            file = fopen(path, "wb");
+            if (!file)
+                return false;
+            fwrite(MAGIC, 1, sizeof(MAGIC), file);
+            fwrite(&VERSION, sizeof(VERSION), 1, file);
+            block.reserve(BLOCK_SIZE + (64 << 10));
+            return true;
+        }
+
+        template<typename T>
+        void put(const T &value) {
+            const uint8_t *bytes = (const uint8_t *) &value;
+            block.insert(block.end(), bytes, bytes + sizeof(T));
+        }
+
+        void payload(const void *data, size_t size) {
+            put((uint32_t) size);
+            block.insert(block.end(), (const uint8_t *) data, (const uint8_t *) data + size);
+        }
+
+        // between records
+        void maybe_flush() {
+            if (block.size() >= BLOCK_SIZE)
+                flush();
+        }
+
+        // total bytes written to the file so far
+        uint64_t close() {
+            flush();
+            fclose(file);
+            file = nullptr;
+            return written;
+        }
+
+    private:
+        FILE *file = nullptr;
+        std::vector<uint8_t> block;
+        std::vector<uint8_t> compressed;
+        uint64_t written = sizeof(MAGIC) + sizeof(VERSION);
+
+        void flush() {
+            if (block.empty())
+                return;
+            compressed.resize(lz4::compress_bound(block.size()));
+            uint32_t sizes[2] = {(uint32_t) block.size(),
+                                 (uint32_t) lz4::compress(block.data(), block.size(), compressed.data())};
+            fwrite(sizes, sizeof(sizes), 1, file);
+            fwrite(compressed.data(), 1, sizes[1], file);
+            written += sizeof(sizes) + sizes[1];
+            block.clear();
+        }
+    };
+
+    // The whole decompressed record stream of a capture file.
+    class Reader {
+    public:
+        bool open(const char *path) {
+            FILE *file = fopen(path, "rb");
+            if (!file)
+                return false;
+            char magic[sizeof(MAGIC)];
+            uint32_t version = 0;
+            bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0
+                      && fread(&version, sizeof(version), 1, file) == 1 && version == VERSION;
+            uint32_t sizes[2];
+            std::vector<uint8_t> compressed;
+            while (ok && fread(sizes, sizeof(sizes), 1, file) == 1) {
+                compressed.resize(sizes[1]);
+                size_t at = stream.size();
+                stream.resize(at + sizes[0]);
+                ok = fread(compressed.data(), 1, sizes[1], file) == sizes[1]
+                     && lz4::decompress(compressed.data(), sizes[1], stream.data() + at, sizes[0]);
+            }
+            fclose(file);
+            return ok;
+        }
+
+        bool done() const {
+            return at >= stream.size();
+        }
+
+        // reads past the end return zeros and set failed
+        template<typename T>
+        T get() {
+            T value{};
+            if (at + sizeof(T) > stream.size()) {
+                failed = true;
+                at = stream.size();
+                return value;
+            }
+            memcpy(&value, stream.data() + at, sizeof(T));
+            at += sizeof(T);
+            return value;
+        }
+
+        // points into the stream, valid as long as the reader
+        const uint8_t *payload(uint32_t &size) {
+            size = get<uint32_t>();
+            if (at + size > stream.size()) {
+                failed = true;
+                at = stream.size();
+                size = 0;
+                return nullptr;
+            }
+            const uint8_t *data = stream.data() + at;
+            at += size;
+            return data;
+        }
+
+        size_t size() const {
+            return stream.size();
+        }
+
+        bool failed = false;
+
+    private:
+        std::vector<uint8_t> stream;
+        size_t at = 0;
+    };
+
+    // Argument roles of generic calls: how a value is stored and what it
+    // becomes on replay. State is the replayer, which owns the name maps.
+    struct Value {
+        template<typename T>
+        static void write(Writer &out, T value) {
+            out.put(value);
+        }
+
+        template<typename T, typename State>
+        static T read(Reader &in, State &) {
+            return in.get<T>();
+        }
+    };
+
+    // buffer offset passed as a pointer (indices, attributes)
+    struct Offset {
+        template<typename T>
+        static void write(Writer &out, T value) {
+            out.put((uint64_t) (uintptr_t) value);
+        }
+
+        template<typename T, typename State>
+        static T read(Reader &in, State &) {
+            return (T) (uintptr_t) in.get<uint64_t>();
+        }
+    };
+
+    template<NameKind KIND>
+    struct Name {
+        static void write(Writer &out, GLuint value) {
+            out.put(value);
+        }
+
+        template<typename T, typename State>
+        static T read(Reader &in, State &state) {
+            return state.name(KIND, in.get<GLuint>());
+        }
+    };
+
+    using BufferName = Name<BUFFER_NAME>;
+    using TextureName = Name<TEXTURE_NAME>;
+    using VertexArrayName = Name<VERTEX_ARRAY_NAME>;
+    using QueryName = Name<QUERY_NAME>;
+    using ProgramName = Name<PROGRAM_NAME>;
+    using ShaderName = Name<SHADER_NAME>;
+
+    struct Sync {
+        static void write(Writer &out, GLsync value) {
+            out.put((uint64_t) (uintptr_t) value);
+        }
+
+        template<typename T, typename State>
+        static T read(Reader &in, State &state) {
+            return state.sync(in.get<uint64_t>());
+        }
+    };
+
+    // of the program in use
+    struct Location {
+        static void write(Writer &out, GLint value) {
+            out.put(value);
+        }
+
+        template<typename T, typename State>
+        static T read(Reader &in, State &state) {
+            return state.location(in.get<GLint>());
+        }
+    };
+
+    // results the call writes; not stored, replay passes scratch memory
+    struct Out {
+        template<typename T>
+        static void write(Writer &, T) {
+        }
+
+        template<typename T, typename State>
+        static T read(Reader &, State &state) {
+            return (T) state.scratch();
+        }
+    };
+
+    // the roles of a generic call's arguments, in order
+    template<typename... Types>
+    struct Roles {
+    };
+
+    // bytes of pixel data glTex(Sub)Image reads for a width x height x
+    // depth region, every row but the last padded to alignment
+    inline size_t pixel_bytes(GLenum format, GLenum type, int width, int height, int depth, int alignment) {
+        int components;
+        switch (format) {
+            case GL_RED:
+            case GL_DEPTH_COMPONENT:
+                components = 1;
+                break;
+            case GL_RG:
+                components = 2;
+                break;
+            case GL_RGB:
+            case GL_BGR:
+                components = 3;
+                break;
+            default:
+                components = 4;
+        }
+        int size;
+        switch (type) {
+            case GL_UNSIGNED_BYTE:
+            case GL_BYTE:
+                size = 1;
+                break;
+            case GL_UNSIGNED_SHORT:
+            case GL_SHORT:
+            case GL_HALF_FLOAT:
+                size = 2;
+                break;
+            default:
+                size = 4;
+        }
+        size_t row = (size_t) width * components * size;
+        size_t rows = (size_t) height * depth;
+        if (rows == 0)
+            return 0;
+        return (row + alignment - 1) / alignment * alignment * (rows - 1) + row;
+    }
+}
+
+#endif //CG_CAPTURE_FORMAT_H
@@ -0,0 +1,59 @@
+#ifndef CG_COMMAND_BENCHMARK_H
+#define CG_COMMAND_BENCHMARK_H
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "command_list.h"
+#include "../threading/job_system.h"
+
+using namespace glm;
+
+// Scaling of parallel command list recording from 1 to N threads: a draw
+// list of 100k objects, each a model matrix, a texture layer uniform and an
+// indexed draw, the way the hex tiles are recorded. Replay needs a GL
+// context, so only recording is timed.
+inline void run_command_benchmark() {
+    const size_t OBJECTS = 100000;
+    const size_t GRAIN = 1024;
+    const int RUNS = 10;
+    std::vector<mat4> models(OBJECTS);
+    for (size_t i = 0; i < OBJECTS; i++) {
+        float f = (float) i;
+        models[i] = translate(mat4(1.f), vec3(sin(f), cos(f), f * 0.001f));
+    }
+    auto record = [&models](CommandList &list, size_t first, size_t last) {
+        list.use_program(1);
+        list.bind_vertex_array(1);
+        for (size_t i = first; i < last; i++) {
+            list.uniform(0, models[i]);
+            list.uniform(1, vec2((float) (i % 16), 0.f));
+            list.draw_elements(GL_TRIANGLE_STRIP, 6, GL_UNSIGNED_INT, 0);
+        }
+    };
+
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    double single = 0;
+    printf("threads     ms/run  speedup  efficiency\n");
+    for (unsigned threads = 1; threads <= max_threads; threads++) {
+        JobSystem jobs(threads - 1);
+        ParallelCommandLists lists;
+        // first run grows the lists, the timed ones reuse them
+        lists.record(jobs, OBJECTS, GRAIN, record);
+        auto start = std::chrono::steady_clock::now();
+        for (int run = 0; run < RUNS; run++)
+            lists.record(jobs, OBJECTS, GRAIN, record);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / RUNS;
+        if (threads == 1) {
+            single = ms;
+            printf("        %zu commands, %.2f MB, %.1f bytes/object\n", lists.commands(),
+                   lists.bytes() / double(1 << 20), lists.bytes() / double(OBJECTS));
+        }
+        printf("%7u %10.3f %8.2f %10.0f%%\n", threads, ms, single / ms, 100 * single / ms / threads);
+    }
+}
+
+#endif //CG_COMMAND_BENCHMARK_H
@@ -0,0 +1,356 @@
+#ifndef CG_COMMAND_LIST_H
+#define CG_COMMAND_LIST_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "state_cache.h"
+#include "../profiling/trace.h"
+#include "../profiling/alloc_tracker.h"
+#include "../profiling/counters.h"
+#include "../threading/job_system.h"
+
+using namespace glm;
+
+// Compact binary stream of GL draws, uniform and buffer updates and state
+// changes. Recording touches no GL, so any thread can build a list; the GL
+// thread replays it with execute(). Each command is a 32-bit header (opcode
+// in the low byte, total size in the rest) followed by its arguments,
+// padded to 4 bytes. clear() keeps the storage, so a list reused every
+// frame stops allocating once it has grown.
+class CommandList {
+public:
+    enum Op : uint8_t {
+        USE_PROGRAM,
+        BIND_VERTEX_ARRAY,
+        BIND_TEXTURE,
+        BIND_UNIFORM_RANGE,
+        SET_ENABLED,
+        POLYGON_MODE,
+        UNIFORM_INT,
+        UNIFORM_VEC2,
+        UNIFORM_MAT4,
+        BUFFER_SUB_DATA,
+        DRAW_ARRAYS,
+        DRAW_ELEMENTS,
+    };
+
+    void clear() {
+        data.clear();
+        count = 0;
+    }
+
+    bool empty() const {
+        return data.empty();
+    }
+
+    size_t bytes() const {
+        return data.size();
+    }
+
+    size_t commands() const {
+        return count;
+    }
+
+    void use_program(GLuint program) {
+        push(USE_PROGRAM, Id{program});
+    }
+
+    void bind_vertex_array(GLuint vao) {
+        push(BIND_VERTEX_ARRAY, Id{vao});
+    }
+
+    void bind_texture(GLuint unit, GLenum target, GLuint texture) {
+        push(BIND_TEXTURE, BindTexture{unit, target, texture});
+    }
+
+    void bind_uniform_range(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+        push(BIND_UNIFORM_RANGE, BindRange{index, buffer, (uint64_t) offset, (uint64_t) size});
+    }
+
+    void set_enabled(GLenum cap, bool enabled) {
+        push(SET_ENABLED, Enable{cap, enabled ? 1u : 0u});
+    }
+
+    void polygon_mode(GLenum mode) {
+        push(POLYGON_MODE, Id{mode});
+    }
+
+    void uniform(GLint location, int value) {
+        push(UNIFORM_INT, UniformInt{location, value});
+    }
+
+    void uniform(GLint location, vec2 value) {
+        push(UNIFORM_VEC2, UniformVec2{location, value});
+    }
+
+    void uniform(GLint location, const mat4 &value) {
+        push(UNIFORM_MAT4, UniformMat4{location, value});
+    }
+
+    // size bytes of src are copied into the list
+    void buffer_sub_data(GLenum target, GLuint buffer, GLintptr offset, const void *src, size_t size) {
+        BufferSubData args{target, buffer, (uint64_t) offset, (uint32_t) size};
+        unsigned char *out = begin(BUFFER_SUB_DATA, sizeof(args) + size);
+        memcpy(out, &args, sizeof(args));
+        memcpy(out + sizeof(args), src, size);
+    }
+
+    void draw_arrays(GLenum mode, GLint first, GLsizei vertices, GLsizei instances = 1) {
+        push(DRAW_ARRAYS, DrawArrays{mode, first, vertices, instances});
+    }
+
+    // offset into the element buffer of the bound vertex array, in bytes
+    void draw_elements(GLenum mode, GLsizei indices, GLenum type, size_t offset, GLsizei instances = 1) {
+        push(DRAW_ELEMENTS, DrawElements{mode, indices, type, instances, (uint64_t) offset});
+    }
+
+    // GL thread: issues the commands in order, state changes through cache
+    void execute(GLStateCache &cache) const {
+        TRACE_ZONE("execute commands");
+        // tallied here and added to the counters once per list
+        int64_t draws = 0, instances = 0, triangles = 0, uniform_bytes = 0, buffer_bytes = 0;
+        const unsigned char *at = data.data();
+        const unsigned char *end = at + data.size();
+        while (at < end) {
+            uint32_t header;
+            memcpy(&header, at, sizeof(header));
+            const unsigned char *args = at + sizeof(header);
+            at += header >> 8;
+            switch ((Op) (header & 0xff)) {
+                case USE_PROGRAM:
+                    cache.use_program(read<Id>(args).id);
+                    break;
+                case BIND_VERTEX_ARRAY:
+                    cache.bind_vertex_array(read<Id>(args).id);
+                    break;
+                case BIND_TEXTURE: {
+                    BindTexture c = read<BindTexture>(args);
+                    cache.bind_texture(c.unit, c.target, c.texture);
+                    break;
+                }
+                case BIND_UNIFORM_RANGE: {
+                    BindRange c = read<BindRange>(args);
+                    cache.bind_uniform_range(c.index, c.buffer, (GLintptr) c.offset, (GLsizeiptr) c.size);
+                    break;
+                }
+                case SET_ENABLED: {
+                    Enable c = read<Enable>(args);
+                    cache.set_enabled(c.cap, c.enabled != 0);
+                    break;
+                }
+                case POLYGON_MODE:
+                    cache.set_polygon_mode(read<Id>(args).id);
+                    break;
+                case UNIFORM_INT: {
+                    UniformInt c = read<UniformInt>(args);
+                    glUniform1i(c.location, c.value);
+                    uniform_bytes += sizeof(c.value);
+                    break;
+                }
+                case UNIFORM_VEC2: {
+                    UniformVec2 c = read<UniformVec2>(args);
+                    glUniform2f(c.location, c.value.x, c.value.y);
+                    uniform_bytes += sizeof(c.value);
+                    break;
+                }
+                case UNIFORM_MAT4: {
+                    UniformMat4 c = read<UniformMat4>(args);
+                    glUniformMatrix4fv(c.location, 1, GL_FALSE, value_ptr(c.value));
+                    uniform_bytes += sizeof(c.value);
+                    break;
+                }
+                case BUFFER_SUB_DATA: {
+                    BufferSubData c = read<BufferSubData>(args);
+                    glBindBuffer(c.target, c.buffer);
+                    glBufferSubData(c.target, (GLintptr) c.offset, c.size, args + sizeof(c));
+                    buffer_bytes += c.size;
+                    break;
+                }
+                case DRAW_ARRAYS: {
+                    DrawArrays c = read<DrawArrays>(args);
+                    if (c.instances == 1)
+                        glDrawArrays(c.mode, c.first, c.vertices);
+                    else
+                        glDrawArraysInstanced(c.mode, c.first, c.vertices, c.instances);
+                    draws++;
+                    instances += c.instances;
+                    triangles += (int64_t) primitives(c.mode, c.vertices) * c.instances;
+                    break;
+                }
+                case DRAW_ELEMENTS: {
+                    DrawElements c = read<DrawElements>(args);
+                    const void *offset = (const void *) (uintptr_t) c.offset;
+                    if (c.instances == 1)
+                        glDrawElements(c.mode, c.indices, c.type, offset);
+                    else
+                        glDrawElementsInstanced(c.mode, c.indices, c.type, offset, c.instances);
+                    draws++;
+                    instances += c.instances;
+                    triangles += (int64_t) primitives(c.mode, c.indices) * c.instances;
+                    break;
+                }
+            }
+        }
+        Counters::add(Counters::DRAW_CALLS, draws);
+        Counters::add(Counters::INSTANCES, instances);
+        Counters::add(Counters::TRIANGLES, triangles);
+        Counters::add(Counters::UNIFORM_BYTES, uniform_bytes);
+        Counters::add(Counters::BUFFER_BYTES, buffer_bytes);
+    }
+
+private:
+    struct Id {
+        GLuint id;
+    };
+
+    struct BindTexture {
+        GLuint unit;
+        GLenum target;
+        GLuint texture;
+    };
+
+    struct BindRange {
+        GLuint index;
+        GLuint buffer;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Enable {
+        GLenum cap;
+        uint32_t enabled;
+    };
+
+    struct UniformInt {
+        GLint location;
+        GLint value;
+    };
+
+    struct UniformVec2 {
+        GLint location;
+        vec2 value;
+    };
+
+    struct UniformMat4 {
+        GLint location;
+        mat4 value;
+    };
+
+    struct BufferSubData {
+        GLenum target;
+        GLuint buffer;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    struct DrawArrays {
+        GLenum mode;
+        GLint first;
+        GLsizei vertices;
+        GLsizei instances;
+    };
+
+    struct DrawElements {
+        GLenum mode;
+        GLsizei indices;
+        GLenum type;
+        GLsizei instances;
+        uint64_t offset;
+    };
+
+    std::vector<unsigned char> data;
+    size_t count = 0;
+
+    // triangles drawn from vertices of mode, 0 for points and lines
+    static GLsizei primitives(GLenum mode, GLsizei vertices) {
+        switch (mode) {
+            case GL_TRIANGLES:
+                return vertices / 3;
+            case GL_TRIANGLE_STRIP:
+            case GL_TRIANGLE_FAN:
+                return std::max(vertices - 2, 0);
+            default:
+                return 0;
+        }
+    }
+
+    // room for a command with size bytes of arguments, header written
+    unsigned char *begin(Op op, size_t size) {
+        size_t total = (sizeof(uint32_t) + size + 3) & ~(size_t) 3;
+        size_t at = data.size();
+        data.resize(at + total);
+        uint32_t header = (uint32_t) (total << 8) | op;
+        memcpy(&data[at], &header, sizeof(header));
+        count++;
+        return &data[at + sizeof(header)];
+    }
+
+    template<typename T>
+    void push(Op op, const T &args) {
+        memcpy(begin(op, sizeof(T)), &args, sizeof(T));
+    }
+
+    template<typename T>
+    static T read(const unsigned char *args) {
+        T value;
+        memcpy(&value, args, sizeof(T));
+        return value;
+    }
+};
+
+// One CommandList per chunk of a range, recorded in parallel on the job
+// system and replayed in chunk order, so the GL stream is the same as a
+// serial recording. Every chunk starts from unknown state and should set
+// what it needs; the state cache drops the repeats at replay. Lists are
+// kept between frames.
+class ParallelCommandLists {
+public:
+    // fn(list, first, last) records items [first, last) into list
+    template<typename F>
+    void record(JobSystem &jobs, size_t count, size_t grain, F fn) {
+        TRACE_ZONE("record command lists");
+        ALLOC_TAG("command recording");
+        grain = std::max<size_t>(grain, 1);
+        used = (count + grain - 1) / grain;
+        if (lists.size() < used)
+            lists.resize(used);
+        std::vector<CommandList> *shared = &lists;
+        jobs.parallel_for(0, used, 1, [shared, &fn, count, grain](size_t first_chunk, size_t last_chunk) {
+            for (size_t chunk = first_chunk; chunk < last_chunk; chunk++) {
+                CommandList &list = (*shared)[chunk];
+                list.clear();
+                fn(list, chunk * grain, std::min(count, (chunk + 1) * grain));
+            }
+        });
+    }
+
+    void execute(GLStateCache &cache) const {
+        for (size_t i = 0; i < used; i++)
+            lists[i].execute(cache);
+    }
+
+    size_t bytes() const {
+        size_t total = 0;
+        for (size_t i = 0; i < used; i++)
+            total += lists[i].bytes();
+        return total;
+    }
+
+    size_t commands() const {
+        size_t total = 0;
+        for (size_t i = 0; i < used; i++)
+            total += lists[i].commands();
+        return total;
+    }
+
+private:
+    std::vector<CommandList> lists;
+    size_t used = 0;
+};
+
+#endif //CG_COMMAND_LIST_H
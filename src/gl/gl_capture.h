@@ -0,0 +1,620 @@
+#ifndef CG_GL_CAPTURE_H
+#define CG_GL_CAPTURE_H
+
+#include <glad/glad.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include "capture_format.h"
+#include "../log/logger.h"
+
+// Records every GL call the application makes, with the data it passes,
+// into a file that cgreplay plays back without the application or its
+// assets. start() swaps the GLAD function pointers for hooks that write a
+// record and call through; it has to run before any GL object exists, so
+// the capture holds everything later frames refer to. All contexts are
+// recorded into one stream in the order their calls ran, with a record
+// whenever the calling context changes. Writes into persistently mapped
+// buffers are not GL calls; they are captured where GL reads them: the
+// source of glCopyBufferSubData, the unpack buffer of texture uploads and
+// ranges bound with glBindBufferRange, which is how this renderer uses
+// its mappings. While recording, GL calls from all threads serialize.
+class GLCapture {
+public:
+    // render thread, right after GLAD is loaded and before other threads
+    // make GL calls
+    static bool start(const char *path) {
+        State &s = state();
+        if (!s.out.open(path)) {
+            LOG_ERROR("capture: cannot write %s", path);
+            return false;
+        }
+        install();
+        s.active.store(true, std::memory_order_release);
+        LOG_INFO("capture: recording GL calls to %s", path);
+        return true;
+    }
+
+    static bool recording() {
+        return state().active.load(std::memory_order_acquire);
+    }
+
+    // render thread, after each glfwSwapBuffers
+    static void end_frame() {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_END_FRAME);
+            state().frames++;
+        }
+    }
+
+    static int frames() {
+        return state().frames;
+    }
+
+    // The hooks stay in place but only call through from here on.
+    static void stop() {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.active.load(std::memory_order_relaxed))
+            return;
+        s.active.store(false, std::memory_order_release);
+        uint64_t bytes = s.out.close();
+        // only used by LOG_INFO, which CG_LOG_LEVEL may compile out
+        (void) bytes;
+        LOG_INFO("capture: %d frames, %llu calls, %.1f MB", s.frames, (unsigned long long) s.calls, bytes / 1048576.0);
+    }
+
+private:
+    // where a mapped buffer's first byte is in client memory
+    struct State {
+        std::mutex mutex;
+        std::atomic<bool> active{false};
+        capture::Writer out;
+        int contexts = 0;
+        int last_context = -1;
+        int frames = 0;
+        uint64_t calls = 0;
+        std::unordered_map<GLuint, const uint8_t *> mapped;
+    };
+
+    // GL state of the calling thread's context the hooks need
+    struct Context {
+        static const int TARGETS = 16;
+        int index = -1;
+        GLint unpack_alignment = 4;
+        GLenum targets[TARGETS] = {};
+        GLuint buffers[TARGETS] = {};
+
+        GLuint bound(GLenum target) const {
+            for (int i = 0; i < TARGETS; i++)
+                if (targets[i] == target)
+                    return buffers[i];
+            return 0;
+        }
+
+        void bind(GLenum target, GLuint buffer) {
+            int free = -1;
+            for (int i = 0; i < TARGETS; i++) {
+                if (targets[i] == target) {
+                    buffers[i] = buffer;
+                    return;
+                }
+                if (targets[i] == 0 && free < 0)
+                    free = i;
+            }
+            if (free >= 0) {
+                targets[free] = target;
+                buffers[free] = buffer;
+            }
+        }
+    };
+
+    static State &state() {
+        static State s;
+        return s;
+    }
+
+    static Context &context() {
+        thread_local Context c;
+        return c;
+    }
+
+    // Holds the capture for one call and its records. on is false when
+    // nothing is being recorded, and then nothing may be written; that
+    // check comes first, so hooks cost next to nothing after stop().
+    class Record {
+        std::unique_lock<std::mutex> lock;
+
+    public:
+        bool on;
+
+        Record() : lock(state().mutex, std::defer_lock), on(recording()) {
+            if (!on)
+                return;
+            lock.lock();
+            State &s = state();
+            on = s.active.load(std::memory_order_relaxed);
+            if (!on)
+                return;
+            Context &c = context();
+            if (c.index < 0)
+                c.index = s.contexts++;
+            if (c.index != s.last_context) {
+                s.out.put(capture::OP_CONTEXT);
+                s.out.put((uint8_t) c.index);
+                s.last_context = c.index;
+            }
+        }
+
+        ~Record() {
+            if (on)
+                state().out.maybe_flush();
+        }
+
+        capture::Writer &out() {
+            return state().out;
+        }
+
+        void op(capture::Op op) {
+            out().put(op);
+            state().calls++;
+        }
+
+        // contents of [offset, offset + size) of buffer, if the
+        // application writes it through a mapping
+        void mapped_write(GLuint buffer, GLintptr offset, size_t size) {
+            auto it = state().mapped.find(buffer);
+            if (!buffer || it == state().mapped.end())
+                return;
+            out().put(capture::OP_MAPPED_WRITE);
+            out().put(buffer);
+            out().put((uint64_t) offset);
+            out().payload(it->second + offset, size);
+        }
+    };
+
+    template<capture::Op OP, typename Fn, Fn *SLOT, typename RoleList>
+    struct GenericHook;
+
+    template<capture::Op OP, typename R, typename... A, R (APIENTRYP *SLOT)(A...), typename... Roles>
+    struct GenericHook<OP, R (APIENTRYP)(A...), SLOT, capture::Roles<Roles...>> {
+        static R (APIENTRYP real)(A...);
+
+        static R APIENTRY hook(A... args) {
+            if (!recording())
+                return real(args...);
+            Record record;
+            if (record.on) {
+                record.op(OP);
+                // a braced list keeps the arguments in order
+                int order[] = {0, (Roles::write(record.out(), args), 0)...};
+                (void) order;
+            }
+            return real(args...);
+        }
+
+        static void install() {
+            real = *SLOT;
+            *SLOT = hook;
+        }
+    };
+
+    // the original entry points of the special calls
+    struct Real {
+#define CG_REAL(name) decltype(glad_gl##name) name = nullptr;
+        CG_SPECIAL_GL_CALLS(CG_REAL)
+#undef CG_REAL
+    };
+
+    static Real &real() {
+        static Real r;
+        return r;
+    }
+
+    static void install() {
+        using namespace capture;
+#define CG_UNPAREN(...) __VA_ARGS__
+#define CG_INSTALL_GENERIC(name, roles) \
+        GenericHook<OP_##name, decltype(glad_gl##name), &glad_gl##name, Roles<CG_UNPAREN roles>>::install();
+        CG_GENERIC_GL_CALLS(CG_INSTALL_GENERIC)
+#undef CG_INSTALL_GENERIC
+#undef CG_UNPAREN
+#define CG_INSTALL_SPECIAL(name) \
+        real().name = glad_gl##name; \
+        glad_gl##name = hook_##name;
+        CG_SPECIAL_GL_CALLS(CG_INSTALL_SPECIAL)
+#undef CG_INSTALL_SPECIAL
+    }
+
+    static void APIENTRY hook_BindBuffer(GLenum target, GLuint buffer) {
+        context().bind(target, buffer);
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_BindBuffer);
+            record.out().put(target);
+            record.out().put(buffer);
+        }
+        real().BindBuffer(target, buffer);
+    }
+
+    static void APIENTRY hook_BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset,
+                                              GLsizeiptr size) {
+        context().bind(target, buffer);
+        Record record;
+        if (record.on) {
+            record.mapped_write(buffer, offset, size);
+            record.op(capture::OP_BindBufferRange);
+            record.out().put(target);
+            record.out().put(index);
+            record.out().put(buffer);
+            record.out().put(offset);
+            record.out().put(size);
+        }
+        real().BindBufferRange(target, index, buffer, offset, size);
+    }
+
+    // data, which may be null, as a flag and a payload
+    static void optional_payload(Record &record, const void *data, size_t size) {
+        record.out().put((uint8_t) (data != nullptr));
+        if (data)
+            record.out().payload(data, size);
+    }
+
+    static void APIENTRY hook_BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_BufferData);
+            record.out().put(target);
+            record.out().put(size);
+            record.out().put(usage);
+            optional_payload(record, data, size);
+        }
+        real().BufferData(target, size, data, usage);
+    }
+
+    static void APIENTRY hook_BufferStorage(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags) {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_BufferStorage);
+            record.out().put(target);
+            record.out().put(size);
+            record.out().put(flags);
+            optional_payload(record, data, size);
+        }
+        real().BufferStorage(target, size, data, flags);
+    }
+
+    static void APIENTRY hook_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_BufferSubData);
+            record.out().put(target);
+            record.out().put(offset);
+            record.out().payload(data, size);
+        }
+        real().BufferSubData(target, offset, size, data);
+    }
+
+    static void APIENTRY hook_CopyBufferSubData(GLenum read_target, GLenum write_target, GLintptr read_offset,
+                                                GLintptr write_offset, GLsizeiptr size) {
+        Record record;
+        if (record.on) {
+            record.mapped_write(context().bound(read_target), read_offset, size);
+            record.op(capture::OP_CopyBufferSubData);
+            record.out().put(read_target);
+            record.out().put(write_target);
+            record.out().put(read_offset);
+            record.out().put(write_offset);
+            record.out().put(size);
+        }
+        real().CopyBufferSubData(read_target, write_target, read_offset, write_offset, size);
+    }
+
+    static GLuint APIENTRY hook_CreateProgram() {
+        Record record;
+        GLuint program = real().CreateProgram();
+        if (record.on) {
+            record.op(capture::OP_CreateProgram);
+            record.out().put(program);
+        }
+        return program;
+    }
+
+    static GLuint APIENTRY hook_CreateShader(GLenum type) {
+        Record record;
+        GLuint shader = real().CreateShader(type);
+        if (record.on) {
+            record.op(capture::OP_CreateShader);
+            record.out().put(type);
+            record.out().put(shader);
+        }
+        return shader;
+    }
+
+    static void names(Record &record, capture::Op op, GLsizei n, const GLuint *names) {
+        record.op(op);
+        record.out().put(n);
+        record.out().payload(names, n * sizeof(GLuint));
+    }
+
+    static void APIENTRY hook_GenBuffers(GLsizei n, GLuint *buffers) {
+        Record record;
+        real().GenBuffers(n, buffers);
+        if (record.on)
+            names(record, capture::OP_GenBuffers, n, buffers);
+    }
+
+    static void APIENTRY hook_GenQueries(GLsizei n, GLuint *queries) {
+        Record record;
+        real().GenQueries(n, queries);
+        if (record.on)
+            names(record, capture::OP_GenQueries, n, queries);
+    }
+
+    static void APIENTRY hook_GenTextures(GLsizei n, GLuint *textures) {
+        Record record;
+        real().GenTextures(n, textures);
+        if (record.on)
+            names(record, capture::OP_GenTextures, n, textures);
+    }
+
+    static void APIENTRY hook_GenVertexArrays(GLsizei n, GLuint *arrays) {
+        Record record;
+        real().GenVertexArrays(n, arrays);
+        if (record.on)
+            names(record, capture::OP_GenVertexArrays, n, arrays);
+    }
+
+    static void APIENTRY hook_DeleteBuffers(GLsizei n, const GLuint *buffers) {
+        Record record;
+        if (record.on) {
+            names(record, capture::OP_DeleteBuffers, n, buffers);
+            for (GLsizei i = 0; i < n; i++)
+                state().mapped.erase(buffers[i]);
+        }
+        real().DeleteBuffers(n, buffers);
+    }
+
+    static void APIENTRY hook_DeleteQueries(GLsizei n, const GLuint *queries) {
+        Record record;
+        if (record.on)
+            names(record, capture::OP_DeleteQueries, n, queries);
+        real().DeleteQueries(n, queries);
+    }
+
+    static void APIENTRY hook_DeleteTextures(GLsizei n, const GLuint *textures) {
+        Record record;
+        if (record.on)
+            names(record, capture::OP_DeleteTextures, n, textures);
+        real().DeleteTextures(n, textures);
+    }
+
+    static void APIENTRY hook_DeleteVertexArrays(GLsizei n, const GLuint *arrays) {
+        Record record;
+        if (record.on)
+            names(record, capture::OP_DeleteVertexArrays, n, arrays);
+        real().DeleteVertexArrays(n, arrays);
+    }
+
+    static GLsync APIENTRY hook_FenceSync(GLenum condition, GLbitfield flags) {
+        Record record;
+        GLsync sync = real().FenceSync(condition, flags);
+        if (record.on) {
+            record.op(capture::OP_FenceSync);
+            record.out().put(condition);
+            record.out().put(flags);
+            capture::Sync::write(record.out(), sync);
+        }
+        return sync;
+    }
+
+    static GLuint APIENTRY hook_GetUniformBlockIndex(GLuint program, const GLchar *name) {
+        Record record;
+        GLuint index = real().GetUniformBlockIndex(program, name);
+        if (record.on) {
+            record.op(capture::OP_GetUniformBlockIndex);
+            record.out().put(program);
+            record.out().payload(name, strlen(name) + 1);
+            record.out().put(index);
+        }
+        return index;
+    }
+
+    static GLint APIENTRY hook_GetUniformLocation(GLuint program, const GLchar *name) {
+        Record record;
+        GLint location = real().GetUniformLocation(program, name);
+        if (record.on) {
+            record.op(capture::OP_GetUniformLocation);
+            record.out().put(program);
+            record.out().payload(name, strlen(name) + 1);
+            record.out().put(location);
+        }
+        return location;
+    }
+
+    static void *APIENTRY hook_MapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) {
+        Record record;
+        void *pointer = real().MapBufferRange(target, offset, length, access);
+        if (record.on) {
+            GLuint buffer = context().bound(target);
+            record.op(capture::OP_MapBufferRange);
+            record.out().put(target);
+            record.out().put(offset);
+            record.out().put(length);
+            record.out().put(access);
+            record.out().put(buffer);
+            if (pointer)
+                state().mapped[buffer] = (const uint8_t *) pointer - offset;
+        }
+        return pointer;
+    }
+
+    static void APIENTRY hook_PixelStorei(GLenum pname, GLint param) {
+        if (pname == GL_UNPACK_ALIGNMENT)
+            context().unpack_alignment = param;
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_PixelStorei);
+            record.out().put(pname);
+            record.out().put(param);
+        }
+        real().PixelStorei(pname, param);
+    }
+
+    static void APIENTRY hook_ShaderSource(GLuint shader, GLsizei count, const GLchar *const *strings,
+                                           const GLint *lengths) {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_ShaderSource);
+            record.out().put(shader);
+            record.out().put(count);
+            for (GLsizei i = 0; i < count; i++)
+                record.out().payload(strings[i], lengths && lengths[i] >= 0 ? lengths[i] : strlen(strings[i]));
+        }
+        real().ShaderSource(shader, count, strings, lengths);
+    }
+
+    // Pixels of a texture upload: from the bound unpack buffer at an
+    // offset (its contents first, if mapped), from client memory, or none.
+    static void pixels(Record &record, const void *pixels, GLenum format, GLenum type, int width, int height,
+                       int depth) {
+        const Context &c = context();
+        GLuint unpack = c.bound(GL_PIXEL_UNPACK_BUFFER);
+        size_t size = capture::pixel_bytes(format, type, width, height, depth, c.unpack_alignment);
+        if (unpack) {
+            record.out().put((uint8_t) 2);
+            record.out().put((uint64_t) (uintptr_t) pixels);
+        } else {
+            optional_payload(record, pixels, size);
+        }
+    }
+
+    static void mapped_pixels(Record &record, const void *pixels, GLenum format, GLenum type, int width, int height,
+                              int depth) {
+        const Context &c = context();
+        record.mapped_write(c.bound(GL_PIXEL_UNPACK_BUFFER), (GLintptr) pixels,
+                            capture::pixel_bytes(format, type, width, height, depth, c.unpack_alignment));
+    }
+
+    static void APIENTRY hook_TexImage2D(GLenum target, GLint level, GLint internal_format, GLsizei width,
+                                         GLsizei height, GLint border, GLenum format, GLenum type,
+                                         const void *data) {
+        Record record;
+        if (record.on) {
+            mapped_pixels(record, data, format, type, width, height, 1);
+            record.op(capture::OP_TexImage2D);
+            record.out().put(target);
+            record.out().put(level);
+            record.out().put(internal_format);
+            record.out().put(width);
+            record.out().put(height);
+            record.out().put(border);
+            record.out().put(format);
+            record.out().put(type);
+            pixels(record, data, format, type, width, height, 1);
+        }
+        real().TexImage2D(target, level, internal_format, width, height, border, format, type, data);
+    }
+
+    static void APIENTRY hook_TexImage3D(GLenum target, GLint level, GLint internal_format, GLsizei width,
+                                         GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type,
+                                         const void *data) {
+        Record record;
+        if (record.on) {
+            mapped_pixels(record, data, format, type, width, height, depth);
+            record.op(capture::OP_TexImage3D);
+            record.out().put(target);
+            record.out().put(level);
+            record.out().put(internal_format);
+            record.out().put(width);
+            record.out().put(height);
+            record.out().put(depth);
+            record.out().put(border);
+            record.out().put(format);
+            record.out().put(type);
+            pixels(record, data, format, type, width, height, depth);
+        }
+        real().TexImage3D(target, level, internal_format, width, height, depth, border, format, type, data);
+    }
+
+    static void APIENTRY hook_TexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width,
+                                            GLsizei height, GLenum format, GLenum type, const void *data) {
+        Record record;
+        if (record.on) {
+            mapped_pixels(record, data, format, type, width, height, 1);
+            record.op(capture::OP_TexSubImage2D);
+            record.out().put(target);
+            record.out().put(level);
+            record.out().put(x);
+            record.out().put(y);
+            record.out().put(width);
+            record.out().put(height);
+            record.out().put(format);
+            record.out().put(type);
+            pixels(record, data, format, type, width, height, 1);
+        }
+        real().TexSubImage2D(target, level, x, y, width, height, format, type, data);
+    }
+
+    static void APIENTRY hook_TexSubImage3D(GLenum target, GLint level, GLint x, GLint y, GLint z, GLsizei width,
+                                            GLsizei height, GLsizei depth, GLenum format, GLenum type,
+                                            const void *data) {
+        Record record;
+        if (record.on) {
+            mapped_pixels(record, data, format, type, width, height, depth);
+            record.op(capture::OP_TexSubImage3D);
+            record.out().put(target);
+            record.out().put(level);
+            record.out().put(x);
+            record.out().put(y);
+            record.out().put(z);
+            record.out().put(width);
+            record.out().put(height);
+            record.out().put(depth);
+            record.out().put(format);
+            record.out().put(type);
+            pixels(record, data, format, type, width, height, depth);
+        }
+        real().TexSubImage3D(target, level, x, y, z, width, height, depth, format, type, data);
+    }
+
+    static void APIENTRY hook_UniformBlockBinding(GLuint program, GLuint index, GLuint binding) {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_UniformBlockBinding);
+            record.out().put(program);
+            record.out().put(index);
+            record.out().put(binding);
+        }
+        real().UniformBlockBinding(program, index, binding);
+    }
+
+    static void APIENTRY hook_UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose,
+                                               const GLfloat *value) {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_UniformMatrix4fv);
+            record.out().put(location);
+            record.out().put(transpose);
+            record.out().payload(value, count * 16 * sizeof(GLfloat));
+        }
+        real().UniformMatrix4fv(location, count, transpose, value);
+    }
+
+    static void APIENTRY hook_UseProgram(GLuint program) {
+        Record record;
+        if (record.on) {
+            record.op(capture::OP_UseProgram);
+            record.out().put(program);
+        }
+        real().UseProgram(program);
+    }
+};
+
+template<capture::Op OP, typename R, typename... A, R (APIENTRYP *SLOT)(A...), typename... Roles>
+R (APIENTRYP GLCapture::GenericHook<OP, R (APIENTRYP)(A...), SLOT, capture::Roles<Roles...>>::real)(A...) = nullptr;
+
+#endif //CG_GL_CAPTURE_H
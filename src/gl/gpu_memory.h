@@ -0,0 +1,190 @@
+#ifndef CG_GPU_MEMORY_H
+#define CG_GPU_MEMORY_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include "../profiling/counters.h"
+#include "../log/logger.h"
+
+// Registry of the memory behind every buffer and texture: size, format or
+// usage hint and an owner tag, per object. Calls go next to the GL calls
+// that allocate (glBufferData, glBufferStorage, glTex*Storage, glTexImage*)
+// and free, from whichever context does them; buffers and textures are
+// shared between contexts, so their names are unique. Sizes are what was
+// asked for; drivers may pad (RGB8 is usually stored as RGBA8), so this is
+// a lower bound. The live total is also the "gpu bytes" gauge.
+class GpuMemory {
+public:
+    enum Kind {
+        BUFFER,
+        TEXTURE
+    };
+
+    struct Resource {
+        Kind kind;
+        // owner, a string literal
+        const char *tag;
+        uint64_t bytes;
+        // usage hint of buffers, internal format of textures
+        GLenum format;
+    };
+
+    // (re)allocated the store of buffer id
+    static void buffer(GLuint id, uint64_t bytes, GLenum usage, const char *tag) {
+        track(BUFFER, id, bytes, usage, tag);
+    }
+
+    // levels of width x height x layers texels, each level half the last
+    static void texture(GLuint id, GLenum internal_format, int width, int height, int layers, int levels,
+                        const char *tag) {
+        uint64_t bytes = 0;
+        for (int level = 0; level < levels; level++)
+            bytes += (uint64_t) std::max(1, width >> level) * std::max(1, height >> level) * layers;
+        track(TEXTURE, id, bytes * texel_bytes(internal_format), internal_format, tag);
+    }
+
+    // after glDeleteBuffers / glDeleteTextures; names never registered are ignored
+    static void release_buffer(GLuint id) {
+        release(BUFFER, id);
+    }
+
+    static void release_texture(GLuint id) {
+        release(TEXTURE, id);
+    }
+
+    static uint64_t live() {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        return state().live;
+    }
+
+    static uint64_t peak() {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        return state().peak;
+    }
+
+    // totals, then with breakdown the live bytes per owner tag, largest first
+    static void print(bool breakdown = false) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        LOG_INFO("gpu memory: %.2f MB live in %zu objects, %.2f MB peak", s.live / 1048576.0, s.resources.size(),
+                 s.peak / 1048576.0);
+        if (!breakdown)
+            return;
+        Category categories[MAX_CATEGORIES];
+        int count = summarize(s, categories);
+        for (int i = 0; i < count; i++) {
+            const Category &c = categories[i];
+            // only used by LOG_INFO, which CG_LOG_LEVEL may compile out
+            (void) c;
+            LOG_INFO("  %-16s %-7s %4d objects %10.1f KB", c.tag, c.kind == BUFFER ? "buffer" : "texture", c.objects,
+                     c.bytes / 1024.0);
+        }
+    }
+
+    // At shutdown, once everything should be deleted: reports whatever
+    // still is registered as errors, so they show at any CG_LOG_LEVEL, and
+    // returns how many objects that is.
+    static int report_leaks() {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (const auto &entry : s.resources) {
+            const Resource &r = entry.second;
+            LOG_ERROR("gpu memory: %s %u (%s, 0x%x) leaked, %llu bytes", r.kind == BUFFER ? "buffer" : "texture",
+                      (unsigned) (entry.first & 0xffffffff), r.tag, r.format, (unsigned long long) r.bytes);
+        }
+        return (int) s.resources.size();
+    }
+
+private:
+    static const int MAX_CATEGORIES = 32;
+
+    struct Category {
+        const char *tag;
+        Kind kind;
+        int objects;
+        uint64_t bytes;
+    };
+
+    struct State {
+        std::mutex mutex;
+        // kind in the top bits, name in the low 32
+        std::unordered_map<uint64_t, Resource> resources;
+        uint64_t live = 0;
+        uint64_t peak = 0;
+    };
+
+    static State &state() {
+        static State s;
+        return s;
+    }
+
+    static uint64_t key(Kind kind, GLuint id) {
+        return (uint64_t) kind << 32 | id;
+    }
+
+    static void track(Kind kind, GLuint id, uint64_t bytes, GLenum format, const char *tag) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        // per-frame reallocations update the entry in place, without allocating
+        Resource &r = s.resources[key(kind, id)];
+        s.live += bytes - r.bytes;
+        s.peak = std::max(s.peak, s.live);
+        r = Resource{kind, tag, bytes, format};
+        Counters::set(Counters::GPU_BYTES, (int64_t) s.live);
+    }
+
+    static void release(Kind kind, GLuint id) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.resources.find(key(kind, id));
+        if (it == s.resources.end())
+            return;
+        s.live -= it->second.bytes;
+        s.resources.erase(it);
+        Counters::set(Counters::GPU_BYTES, (int64_t) s.live);
+    }
+
+    static int summarize(const State &s, Category *categories) {
+        int count = 0;
+        for (const auto &entry : s.resources) {
+            const Resource &r = entry.second;
+            int i = 0;
+            while (i < count && !(categories[i].kind == r.kind && strcmp(categories[i].tag, r.tag) == 0))
+                i++;
+            if (i == count) {
+                if (count == MAX_CATEGORIES)
+                    continue;
+                categories[count++] = Category{r.tag, r.kind, 0, 0};
+            }
+            categories[i].objects++;
+            categories[i].bytes += r.bytes;
+        }
+        std::sort(categories, categories + count, [](const Category &a, const Category &b) {
+            return a.bytes > b.bytes;
+        });
+        return count;
+    }
+
+    static int texel_bytes(GLenum internal_format) {
+        switch (internal_format) {
+            case GL_R8:
+                return 1;
+            case GL_RG8:
+                return 2;
+            case GL_RGB8:
+                return 3;
+            case GL_RGBA16F:
+                return 8;
+            case GL_RGBA32F:
+                return 16;
+            default:
+                return 4;
+        }
+    }
+};
+
+#endif //CG_GPU_MEMORY_H
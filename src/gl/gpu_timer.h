@@ -0,0 +1,233 @@
+#ifndef CG_GPU_TIMER_H
+#define CG_GPU_TIMER_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "../profiling/trace.h"
+#include "../log/logger.h"
+
+// GPU time of render passes, from GL_TIMESTAMP queries written around
+// each zone. Every frame in flight has its own slot of queries, created
+// once and reused; a slot is read back when the frame comes round again
+// (FRAMES - 1 frames later), and only if the GPU is done with it, so the
+// CPU never waits on a result: a frame whose slot is still busy is not
+// measured. Timestamps rather than GL_TIME_ELAPSED so zones can nest.
+// GPU time is mapped onto the Trace clock with a GL_TIMESTAMP read taken
+// now and then, and the zones show up as a "GPU" track in trace captures.
+// GL thread only.
+class GpuTimer {
+public:
+    static const int FRAMES = 4;
+    // zones per frame; more are not measured
+    static const int MAX_ZONES = 16;
+    // distinct zone names with statistics
+    static const int MAX_NAMES = 16;
+    // frames the rolling statistics cover
+    static const int WINDOW = 120;
+
+    GpuTimer() {
+        GLint bits = 0;
+        glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+        supported = bits > 0;
+        if (!supported) {
+            LOG_WARNING("GL timestamp queries not supported, no GPU timings");
+            return;
+        }
+        for (Frame &frame : frames)
+            glGenQueries(2 * MAX_ZONES, frame.queries);
+        track = &Trace::add_track("GPU");
+        calibrate();
+    }
+
+    ~GpuTimer() {
+        if (supported)
+            for (Frame &frame : frames)
+                glDeleteQueries(2 * MAX_ZONES, frame.queries);
+    }
+
+    GpuTimer(const GpuTimer &) = delete;
+
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void begin_frame() {
+        if (!supported)
+            return;
+        Frame &frame = frames[current % FRAMES];
+        if (frame.zones > 0 && !resolve(frame)) {
+            // the GPU is FRAMES frames behind, skip this one rather than wait
+            measuring = false;
+            busy++;
+            return;
+        }
+        frame.zones = 0;
+        measuring = true;
+        if (current % CALIBRATE_FRAMES == 0)
+            calibrate();
+    }
+
+    // index to pass to end(), -1 when not measured
+    int begin(const char *name) {
+        if (!measuring)
+            return -1;
+        Frame &frame = frames[current % FRAMES];
+        if (frame.zones == MAX_ZONES)
+            return -1;
+        int zone = frame.zones++;
+        frame.names[zone] = name;
+        frame.last = frame.queries[2 * zone];
+        glQueryCounter(frame.last, GL_TIMESTAMP);
+        return zone;
+    }
+
+    void end(int zone) {
+        if (zone < 0)
+            return;
+        Frame &frame = frames[current % FRAMES];
+        frame.last = frame.queries[2 * zone + 1];
+        glQueryCounter(frame.last, GL_TIMESTAMP);
+    }
+
+    // after the last zone: picks up whatever earlier frames have finished
+    void end_frame() {
+        if (!supported)
+            return;
+        current++;
+        // oldest first
+        for (int i = 0; i < FRAMES; i++) {
+            Frame &frame = frames[(current + i) % FRAMES];
+            if (frame.zones > 0 && !resolve(frame))
+                break;
+        }
+    }
+
+    // mean and max over the last WINDOW frames measured, then frames not measured
+    void print() {
+        if (!supported)
+            return;
+        char line[512];
+        int length = 0;
+        for (int i = 0; i < names_used && length < (int) sizeof(line); i++) {
+            const Stats &stats = names[i];
+            double max = 0;
+            for (int s = 0; s < std::min(stats.samples, (int) WINDOW); s++)
+                max = std::max(max, stats.window[s]);
+            length += snprintf(line + length, sizeof(line) - length, " %s %.3f ms (max %.3f),", stats.name,
+                               average(i), max);
+        }
+        LOG_INFO("gpu:%s %d frames not measured", length ? line : "", busy);
+        busy = 0;
+    }
+
+    // zone names seen so far, in order of first appearance
+    int zone_count() const {
+        return names_used;
+    }
+
+    const char *zone_name(int index) const {
+        return names[index].name;
+    }
+
+    // mean GPU ms of a zone over the last WINDOW frames measured
+    double average(int index) const {
+        const Stats &stats = names[index];
+        int n = std::min(stats.samples, (int) WINDOW);
+        double sum = 0;
+        for (int s = 0; s < n; s++)
+            sum += stats.window[s];
+        return n ? sum / n : 0;
+    }
+
+private:
+    static const long CALIBRATE_FRAMES = 600;
+
+    struct Frame {
+        GLuint queries[2 * MAX_ZONES];
+        const char *names[MAX_ZONES];
+        // zones written, 0 once read back
+        int zones = 0;
+        // query written last
+        GLuint last = 0;
+    };
+
+    struct Stats {
+        const char *name;
+        double window[WINDOW];
+        int samples;
+    };
+
+    bool supported = false;
+    bool measuring = false;
+    long current = 0;
+    int busy = 0;
+    Frame frames[FRAMES];
+    Stats names[MAX_NAMES];
+    int names_used = 0;
+    Trace::Buffer *track = nullptr;
+    // Trace::now() minus GPU time
+    int64_t offset = 0;
+
+    void calibrate() {
+        GLint64 gpu = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu);
+        offset = (int64_t) Trace::now() - gpu;
+    }
+
+    // false if the GPU is not done with the frame yet
+    bool resolve(Frame &frame) {
+        // queries finish in order, the last one decides for all
+        GLuint available = 0;
+        glGetQueryObjectuiv(frame.last, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+        bool tracing = Trace::enabled();
+        for (int zone = 0; zone < frame.zones; zone++) {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(frame.queries[2 * zone], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(frame.queries[2 * zone + 1], GL_QUERY_RESULT, &end);
+            add_sample(frame.names[zone], (end - begin) / 1e6);
+            if (tracing && (int64_t) begin + offset >= 0)
+                Trace::record(*track, frame.names[zone], begin + offset, end + offset);
+        }
+        frame.zones = 0;
+        return true;
+    }
+
+    void add_sample(const char *name, double ms) {
+        int i = 0;
+        while (i < names_used && strcmp(names[i].name, name) != 0)
+            i++;
+        if (i == names_used) {
+            if (names_used == MAX_NAMES)
+                return;
+            names[names_used++] = Stats{name, {}, 0};
+        }
+        Stats &stats = names[i];
+        stats.window[stats.samples++ % WINDOW] = ms;
+        // keeps the index in range without forgetting that the window is full
+        if (stats.samples == 2 * WINDOW)
+            stats.samples = WINDOW;
+    }
+};
+
+// Times its scope on the GPU.
+class GpuZone {
+public:
+    GpuZone(GpuTimer &timer, const char *name) : timer(timer), zone(timer.begin(name)) {}
+
+    ~GpuZone() {
+        timer.end(zone);
+    }
+
+    GpuZone(const GpuZone &) = delete;
+
+    GpuZone &operator=(const GpuZone &) = delete;
+
+private:
+    GpuTimer &timer;
+    int zone;
+};
+
+#endif //CG_GPU_TIMER_H
@@ -0,0 +1,133 @@
+#ifndef CG_STAGING_BUFFER_H
+#define CG_STAGING_BUFFER_H
+
+#include <glad/glad.h>
+#include <deque>
+#include <vector>
+#include "gpu_memory.h"
+
+// Ring allocator over one persistently mapped buffer that uploads are
+// copied through. Allocations are retired in order by the fence placed
+// after the GL commands that read them; allocate() waits for the oldest
+// fence when the ring is full. Without GL 4.4, or for requests larger
+// than the ring, it hands out client memory instead (buffer 0).
+// Single-threaded: owned by the upload thread.
+class StagingBuffer {
+public:
+    struct Span {
+        GLuint buffer;
+        size_t offset;
+        unsigned char *ptr;
+    };
+
+    explicit StagingBuffer(size_t capacity = 16 << 20) : capacity(capacity) {
+        if (!GLAD_GL_VERSION_4_4)
+            return;
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBufferStorage(GL_COPY_READ_BUFFER, capacity, nullptr, flags);
+        GpuMemory::buffer(buffer, capacity, GL_STREAM_DRAW, "staging");
+        mapped = (unsigned char *) glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, flags);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    ~StagingBuffer() {
+        for (Region &region : regions)
+            glDeleteSync(region.fence);
+        if (buffer) {
+            glDeleteBuffers(1, &buffer);
+            GpuMemory::release_buffer(buffer);
+        }
+    }
+
+    StagingBuffer(const StagingBuffer &) = delete;
+
+    StagingBuffer &operator=(const StagingBuffer &) = delete;
+
+    // valid until the next fence() has signaled
+    Span allocate(size_t size) {
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        if (!mapped || size > capacity) {
+            scratch.resize(size);
+            return Span{0, 0, scratch.data()};
+        }
+        while (!fits(size)) {
+            if (regions.empty())
+                fence();
+            wait_oldest();
+        }
+        if (!pending) {
+            pending = true;
+            pending_begin = head;
+        }
+        Span span{buffer, head, mapped + head};
+        head += size;
+        return span;
+    }
+
+    // after the GL commands reading everything allocated so far
+    void fence() {
+        if (!pending)
+            return;
+        regions.push_back(Region{pending_begin, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+        pending = false;
+    }
+
+    // frees regions the GPU is done with, without waiting
+    void retire() {
+        while (!regions.empty()) {
+            GLint status = GL_UNSIGNALED;
+            glGetSynciv(regions.front().fence, GL_SYNC_STATUS, 1, nullptr, &status);
+            if (status != GL_SIGNALED)
+                return;
+            glDeleteSync(regions.front().fence);
+            regions.pop_front();
+        }
+    }
+
+private:
+    static const size_t ALIGNMENT = 256;
+
+    struct Region {
+        size_t begin;
+        GLsync fence;
+    };
+
+    size_t capacity;
+    GLuint buffer = 0;
+    unsigned char *mapped = nullptr;
+    std::vector<unsigned char> scratch;
+    std::deque<Region> regions;
+    size_t head = 0;
+    bool pending = false;
+    size_t pending_begin = 0;
+
+    // may move head back to the start of the ring
+    bool fits(size_t size) {
+        if (regions.empty() && !pending) {
+            head = 0;
+            return true;
+        }
+        size_t tail = regions.empty() ? pending_begin : regions.front().begin;
+        if (head >= tail) {
+            if (capacity - head >= size)
+                return true;
+            // wrap; strictly less so head never catches up with tail
+            if (size < tail) {
+                head = 0;
+                return true;
+            }
+            return false;
+        }
+        return tail - head > size;
+    }
+
+    void wait_oldest() {
+        glClientWaitSync(regions.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(regions.front().fence);
+        regions.pop_front();
+    }
+};
+
+#endif //CG_STAGING_BUFFER_H
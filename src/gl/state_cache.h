@@ -0,0 +1,140 @@
+#ifndef CG_STATE_CACHE_H
+#define CG_STATE_CACHE_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include "../profiling/counters.h"
+
+// Shadow copy of the GL state that command lists change, so binds that
+// would not change anything are dropped before they reach the driver.
+// Everything starts unknown. Call invalidate() whenever GL state was
+// changed behind its back (Shader::use(), upload callbacks, ...).
+// GL thread only.
+class GLStateCache {
+public:
+    static const int TEXTURE_UNITS = 16;
+    static const int UNIFORM_BINDINGS = 16;
+
+    GLStateCache() {
+        invalidate();
+    }
+
+    void invalidate() {
+        program = UNKNOWN;
+        vertex_array = UNKNOWN;
+        active_unit = UNKNOWN;
+        for (Texture &texture : textures)
+            texture = Texture{0, UNKNOWN};
+        for (Range &range : uniform_ranges)
+            range = Range{UNKNOWN, 0, 0};
+        for (Capability &capability : capabilities)
+            capability = Capability{0, false};
+        polygon_mode = UNKNOWN;
+    }
+
+    void use_program(GLuint id) {
+        if (program == id)
+            return redundant();
+        glUseProgram(id);
+        program = id;
+        Counters::add(Counters::PROGRAM_BINDS);
+    }
+
+    void bind_vertex_array(GLuint id) {
+        if (vertex_array == id)
+            return redundant();
+        glBindVertexArray(id);
+        vertex_array = id;
+        Counters::add(Counters::VAO_BINDS);
+    }
+
+    void bind_texture(GLuint unit, GLenum target, GLuint id) {
+        if (unit < TEXTURE_UNITS) {
+            Texture &bound = textures[unit];
+            if (bound.target == target && bound.id == id)
+                return redundant();
+            bound = Texture{target, id};
+        }
+        active_texture(unit);
+        glBindTexture(target, id);
+        Counters::add(Counters::TEXTURE_BINDS);
+    }
+
+    void bind_uniform_range(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+        if (index < UNIFORM_BINDINGS) {
+            Range &bound = uniform_ranges[index];
+            if (bound.buffer == buffer && bound.offset == offset && bound.size == size)
+                return redundant();
+            bound = Range{buffer, offset, size};
+        }
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+    }
+
+    void set_enabled(GLenum cap, bool enabled) {
+        Capability *slot = find(cap);
+        if (slot && slot->cap == cap && slot->enabled == enabled)
+            return redundant();
+        if (enabled)
+            glEnable(cap);
+        else
+            glDisable(cap);
+        if (slot)
+            *slot = Capability{cap, enabled};
+    }
+
+    void set_polygon_mode(GLenum mode) {
+        if (polygon_mode == mode)
+            return redundant();
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+        polygon_mode = mode;
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xffffffffu;
+    static const int CAPABILITIES = 8;
+
+    struct Texture {
+        GLenum target;
+        GLuint id;
+    };
+
+    struct Range {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    struct Capability {
+        GLenum cap;
+        bool enabled;
+    };
+
+    GLuint program;
+    GLuint vertex_array;
+    GLuint active_unit;
+    Texture textures[TEXTURE_UNITS];
+    Range uniform_ranges[UNIFORM_BINDINGS];
+    Capability capabilities[CAPABILITIES];
+    GLenum polygon_mode;
+
+    void redundant() {
+        Counters::add(Counters::BINDS_SKIPPED);
+    }
+
+    void active_texture(GLuint unit) {
+        if (active_unit == unit)
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit = unit;
+    }
+
+    // slot tracking cap, or a free one; null when all are taken
+    Capability *find(GLenum cap) {
+        for (Capability &capability : capabilities)
+            if (capability.cap == cap || capability.cap == 0)
+                return &capability;
+        return nullptr;
+    }
+};
+
+#endif //CG_STATE_CACHE_H
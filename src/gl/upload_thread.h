@@ -0,0 +1,274 @@
+#ifndef CG_UPLOAD_THREAD_H
+#define CG_UPLOAD_THREAD_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "gpu_memory.h"
+#include "staging_buffer.h"
+#include "../profiling/trace.h"
+#include "../profiling/alloc_tracker.h"
+#include "../profiling/counters.h"
+#include "../log/logger.h"
+
+// GL helpers available to upload work, running in the upload context.
+class UploadContext {
+public:
+    explicit UploadContext(StagingBuffer &staging) : staging(staging) {}
+
+    // new buffer object holding data, accounted to tag in GpuMemory
+    GLuint create_buffer(const char *tag, const void *data, size_t size, GLenum usage = GL_STATIC_DRAW) {
+        GLuint id;
+        glGenBuffers(1, &id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, usage);
+        GpuMemory::buffer(id, size, usage, tag);
+        StagingBuffer::Span span = staging.allocate(size);
+        memcpy(span.ptr, data, size);
+        if (span.buffer) {
+            glBindBuffer(GL_COPY_READ_BUFFER, span.buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, span.offset, 0, size);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        } else {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, span.ptr);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        bytes += size;
+        Counters::add(Counters::BUFFER_BYTES, size);
+        return id;
+    }
+
+    // One mip level of a bound GL_TEXTURE_2D (layer < 0) or a layer of a
+    // bound GL_TEXTURE_2D_ARRAY. Rows are tightly packed.
+    void texture_level(int level, int layer, int width, int height, GLenum format, const void *data,
+                       size_t size) {
+        StagingBuffer::Span span = staging.allocate(size);
+        memcpy(span.ptr, data, size);
+        const void *pixels = span.ptr;
+        if (span.buffer) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, span.buffer);
+            pixels = (const void *) span.offset;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (layer < 0)
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format, GL_UNSIGNED_BYTE, pixels);
+        else
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, GL_UNSIGNED_BYTE,
+                            pixels);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        bytes += size;
+        Counters::add(Counters::TEXTURE_BYTES, size);
+    }
+
+    size_t bytes = 0;
+
+private:
+    StagingBuffer &staging;
+};
+
+// Creates and fills GL objects on a thread of its own, in a context shared
+// with the renderer, so large uploads never stall a frame. Work may be
+// submitted from any thread; each item is fenced, and its completion
+// callback runs on the render thread in collect() once the GPU is done.
+// Vertex arrays are not shared between contexts, so completion callbacks
+// are where they get built. Completions own what their uploads created;
+// drain() runs all of them at shutdown, and the destructor drains whatever
+// is left, so whatever callbacks capture must outlive the thread or be
+// drained before it goes.
+class UploadThread {
+public:
+    // window: hidden, its context sharing objects with the render context
+    explicit UploadThread(GLFWwindow *window) : window(window) {
+        thread = std::thread([this] { run(); });
+    }
+
+    ~UploadThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        // the thread finishes the queue before it stops
+        thread.join();
+        drain();
+    }
+
+    UploadThread(const UploadThread &) = delete;
+
+    UploadThread &operator=(const UploadThread &) = delete;
+
+    // any thread
+    void submit(std::function<void(UploadContext &)> work, std::function<void()> done) {
+        push(Item{std::move(work), std::move(done), nullptr, glfwGetTime(), 0});
+    }
+
+    // Render thread: objects it created before this call are complete for
+    // every upload submitted after it.
+    void barrier() {
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        push(Item{nullptr, nullptr, fence, glfwGetTime(), 0});
+    }
+
+    // Render thread, at a frame boundary: runs the callbacks of finished
+    // uploads and returns how many. Textures written by the upload thread
+    // must be bound again before the changes are guaranteed visible.
+    int collect() {
+        TRACE_ZONE("upload collect");
+        ALLOC_TAG("upload collect");
+        std::vector<Item> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!finished.empty()) {
+                GLint status = GL_UNSIGNALED;
+                glGetSynciv(finished.front().fence, GL_SYNC_STATUS, 1, nullptr, &status);
+                if (status != GL_SIGNALED)
+                    break;
+                ready.push_back(std::move(finished.front()));
+                finished.pop_front();
+            }
+        }
+        double now = glfwGetTime();
+        for (Item &item : ready) {
+            glDeleteSync(item.fence);
+            if (item.done)
+                item.done();
+            double latency = now - item.submitted;
+            stats.completed++;
+            stats.bytes += item.bytes;
+            stats.latency_total += latency;
+            stats.latency_max = std::max(stats.latency_max, latency);
+        }
+        return (int) ready.size();
+    }
+
+    // Render thread: waits until every upload submitted so far is done on
+    // the GPU and runs all their completions. Work submitted meanwhile by
+    // other threads is waited for too.
+    void drain() {
+        TRACE_ZONE("upload drain");
+        std::vector<GLsync> fences;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            drained.wait(lock, [this] { return queue.empty() && !busy; });
+            for (const Item &item : finished)
+                fences.push_back(item.fence);
+        }
+        for (GLsync fence : fences) {
+            GLenum result;
+            do
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            while (result == GL_TIMEOUT_EXPIRED);
+        }
+        collect();
+    }
+
+    // nothing queued, uploading or waiting for collect()
+    bool idle() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.empty() && finished.empty() && !busy;
+    }
+
+    // throughput and submit-to-collect latency since the last call
+    void print(double seconds) {
+        size_t depth;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            depth = queue.size() + finished.size() + (busy ? 1 : 0);
+        }
+        if (stats.completed > 0 || depth > 0)
+            LOG_INFO("uploads: %d done, %.2f MB/s, latency %.2f ms avg %.2f ms max, %d queued", stats.completed,
+                   stats.bytes / seconds / (1 << 20),
+                   stats.completed ? 1000 * stats.latency_total / stats.completed : 0.0,
+                   1000 * stats.latency_max, (int) depth);
+        stats = Stats();
+    }
+
+private:
+    struct Item {
+        std::function<void(UploadContext &)> work;
+        std::function<void()> done;
+        // render-thread fence for barriers, completion fence afterwards
+        GLsync fence;
+        double submitted;
+        size_t bytes;
+    };
+
+    struct Stats {
+        int completed = 0;
+        size_t bytes = 0;
+        double latency_total = 0;
+        double latency_max = 0;
+    };
+
+    GLFWwindow *window;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    // queue empty and nothing uploading
+    std::condition_variable drained;
+    std::deque<Item> queue;
+    std::deque<Item> finished;
+    bool busy = false;
+    bool stopping = false;
+    Stats stats;
+
+    void push(Item item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(item));
+        }
+        cv.notify_one();
+    }
+
+    void run() {
+        glfwMakeContextCurrent(window);
+        Trace::name_thread("upload");
+        {
+            StagingBuffer staging;
+            while (true) {
+                Item item;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return stopping || !queue.empty(); });
+                    if (queue.empty())
+                        break;
+                    item = std::move(queue.front());
+                    queue.pop_front();
+                    busy = true;
+                }
+                if (!item.work) {
+                    glWaitSync(item.fence, 0, GL_TIMEOUT_IGNORED);
+                    glDeleteSync(item.fence);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy = false;
+                    drained.notify_all();
+                    continue;
+                }
+                UploadContext context(staging);
+                TRACE_ZONE("upload item");
+                item.work(context);
+                staging.fence();
+                item.bytes = context.bytes;
+                item.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();
+                staging.retire();
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back(std::move(item));
+                busy = false;
+                drained.notify_all();
+            }
+        }
+        glfwMakeContextCurrent(nullptr);
+    }
+};
+
+#endif //CG_UPLOAD_THREAD_H
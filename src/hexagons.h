@@ -11,6 +11,11 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "shader.h"
+#include "gl/command_list.h"
+#include "profiling/trace.h"
+#include "profiling/alloc_tracker.h"
+#include "gl/gpu_memory.h"
+#include "gl/upload_thread.h"
 
 using namespace glm;
 using namespace std;
@@ -18,41 +23,28 @@ using namespace std;
 class HexagonAnimation {
 public:
     static const int MAX_USED_TILES = 1000;
-    uint tileVBO, tileVAO, tileEBO;
-    uint uModel;
+    // rings the used grid holds before wrapping onto itself
+    static const int UNBOUNDED_DEPTH = MAX_USED_TILES / 2;
+    uint tileVBO = 0, tileVAO = 0, tileEBO = 0;
+    uint program = 0;
+    GLint uModel = -1;
     vec3 vertices[6];
     uint order[6] = {0, 5, 1, 4, 2, 3};
     float R = 0.3;
     float T = 3.0f; // seconds
     int DIV = 6;
+    // rings beyond this never unfold, so the animation comes to rest
+    int MAX_DEPTH;
     int pieces_drawn = 0;
     double start_time, local_time;
-    mat4 &view;
-    mat4 &proj;
     char **used;
+    // model matrices produced by the last simulate()
+    vector<mat4> *tiles = nullptr;
 
-    HexagonAnimation(mat4 &view, mat4 &proj) : view(view), proj(proj) {
-        glGenBuffers(1, &tileVBO);
-        glGenBuffers(1, &tileEBO);
-        glGenVertexArrays(1, &tileVAO);
-        glBindVertexArray(tileVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, tileVBO);
-        for (int i = 0; i < 6; i++) {
-            float ang = radians(i * 60.f);
-            vertices[i].x = cos(ang) * R;
-            vertices[i].z = sin(ang) * R;
-            vertices[i].y = 0;
-        }
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tileEBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(order), order, GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12, 0);
-        glEnableVertexAttribArray(0);
-
-        glBindVertexArray(0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
+    // max_depth caps the rings so the field settles; by default it keeps
+    // unfolding until the used grid is full
+    explicit HexagonAnimation(int max_depth = UNBOUNDED_DEPTH) : MAX_DEPTH(std::min(max_depth, (int) UNBOUNDED_DEPTH)) {
+        outline(R);
         used = new char *[MAX_USED_TILES];
         for (int i = 0; i < MAX_USED_TILES; i++) {
             used[i] = new char[MAX_USED_TILES];
@@ -61,8 +53,7 @@ public:
     }
 
     void drawTile(mat4 &model) {
-        glUniformMatrix4fv(uModel, 1, GL_FALSE, value_ptr(model));
-        glDrawElements(GL_TRIANGLE_STRIP, 6, GL_UNSIGNED_INT, 0);
+        tiles->push_back(model);
         pieces_drawn++;
     }
 
@@ -74,13 +65,15 @@ public:
         vec3 start_pos;
     };
 
+    // FIFO of the BFS, kept between runs so it stops allocating
+    vector<tile_info> frontier;
+
     void bfs_draw() {
-        queue<tile_info> q;
-        q.push(tile_info{0, 0, 0, mat4(1), vec3(0, 0, 0)});
+        frontier.clear();
+        frontier.push_back(tile_info{0, 0, 0, mat4(1), vec3(0, 0, 0)});
         used[0][0] = 1;
-        while (!q.empty()) {
-            tile_info tile = q.front();
-            q.pop();
+        for (size_t head = 0; head < frontier.size(); head++) {
+            tile_info tile = frontier[head];
             // drawing cur_tile
             float time_depth = local_time / T;
             if (time_depth < tile.depth)
@@ -110,9 +103,9 @@ public:
                 int child_j = tile.virt_j + dj[i];
                 int wrap_i = mmod(child_i, MAX_USED_TILES);
                 int wrap_j = mmod(child_j, MAX_USED_TILES);
-                if (!used[wrap_i][wrap_j]) {
+                if (tile.depth < MAX_DEPTH && !used[wrap_i][wrap_j]) {
                     used[wrap_i][wrap_j] = true;
-                    q.push(tile_info{child_i, child_j, tile.depth + 1, child_model, child_start_pos});
+                    frontier.push_back(tile_info{child_i, child_j, tile.depth + 1, child_model, child_start_pos});
                 }
                 new_model = y_m_rot * new_model;
                 rot_shift = y_q_rot * rot_shift;
@@ -120,21 +113,103 @@ public:
         }
     }
 
-    // will be called every render
-    void draw(Shader &shader) {
-        local_time = glfwGetTime() - start_time;
+    // Runs the BFS for time and collects every visible tile's model matrix
+    // into out. Touches no GL state, so it may run off the render thread.
+    void simulate(double time, vector<mat4> &out) {
+        TRACE_ZONE("hex bfs");
+        ALLOC_TAG("hex bfs");
+        local_time = time - start_time;
         pieces_drawn = 0;
-        shader.use();
-        uModel = glGetUniformLocation(shader.ID, "model");
-        glBindVertexArray(tileVAO);
+        out.clear();
+        // Every ring that can unfold, so neither grows while the field does;
+        // unbounded, only the rings reached so far, a full grid is ~50 MB.
+        int depth = MAX_DEPTH < UNBOUNDED_DEPTH ? MAX_DEPTH : std::min(MAX_DEPTH, (int) (local_time / T) + 1);
+        size_t max_tiles = 1 + 3 * (size_t) depth * (depth + 1);
+        out.reserve(max_tiles);
+        frontier.reserve(max_tiles);
+        tiles = &out;
         bfs_draw();
+        tiles = nullptr;
         for (int i = 0; i < MAX_USED_TILES; i++)
             fill(used[i], used[i] + MAX_USED_TILES, 0);
     }
 
+    // true once every ring has unfolded; nothing moves after that
+    bool settled(double time) const {
+        return (time - start_time) / T > MAX_DEPTH + 1;
+    }
+
+    // Tile buffers are filled on the upload thread; the VAO is built on the
+    // render thread once they are done. Nothing draws until then.
+    void upload(UploadThread &uploads) {
+        uploads.submit([this](UploadContext &context) {
+            tileVBO = context.create_buffer("hex tile", vertices, sizeof(vertices));
+            tileEBO = context.create_buffer("hex tile", order, sizeof(order));
+        }, [this] {
+            glGenVertexArrays(1, &tileVAO);
+            glBindVertexArray(tileVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, tileVBO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tileEBO);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12, 0);
+            glEnableVertexAttribArray(0);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        });
+    }
+
+    // Reshapes the tile for radius; the layout follows R already, this keeps
+    // the tiles meeting edge to edge. GL thread, once upload() has finished.
+    void rebuild_mesh(float radius) {
+        TRACE_ZONE("hex mesh rebuild");
+        outline(radius);
+        glBindBuffer(GL_ARRAY_BUFFER, tileVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // GL objects go with the context; the animation itself may outlive it
+    void release() {
+        glDeleteVertexArrays(1, &tileVAO);
+        glDeleteBuffers(1, &tileVBO);
+        glDeleteBuffers(1, &tileEBO);
+        GpuMemory::release_buffer(tileVBO);
+        GpuMemory::release_buffer(tileEBO);
+        tileVAO = tileVBO = tileEBO = 0;
+    }
+
+    // program the tiles are drawn with; GL thread, before recording
+    void set_shader(const Shader &shader) {
+        program = shader.ID;
+        uModel = glGetUniformLocation(shader.ID, "model");
+    }
+
+    // Records tiles [first, last) of the ones produced by simulate(). Issues
+    // no GL, so chunks may be recorded on any thread.
+    void record(CommandList &list, const vector<mat4> &models, size_t first, size_t last) const {
+        TRACE_ZONE("hex record");
+        if (!tileVAO)
+            return;
+        list.use_program(program);
+        list.bind_vertex_array(tileVAO);
+        for (size_t i = first; i < last; i++) {
+            list.uniform(uModel, models[i]);
+            list.draw_elements(GL_TRIANGLE_STRIP, 6, GL_UNSIGNED_INT, 0);
+        }
+    }
+
     void reset() {
         start_time = glfwGetTime();
     }
+
+private:
+    void outline(float radius) {
+        for (int i = 0; i < 6; i++) {
+            float ang = radians(i * 60.f);
+            vertices[i].x = cos(ang) * radius;
+            vertices[i].z = sin(ang) * radius;
+            vertices[i].y = 0;
+        }
+    }
 };
 
 #endif //CG_HEXAGONS_H
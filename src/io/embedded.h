@@ -0,0 +1,36 @@
+#ifndef CG_EMBEDDED_H
+#define CG_EMBEDDED_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Files compiled into the binary by cmake/embed_resources.cmake.
+struct EmbeddedFile {
+    const char *name;
+    const unsigned char *data;
+    size_t size;
+};
+
+#ifdef CG_EMBED_RESOURCES
+
+// defined once, in the generated embedded_resources.cpp; terminated by an
+// entry with a null name
+extern const EmbeddedFile EMBEDDED_FILES[];
+
+inline const EmbeddedFile *find_embedded(const std::string &name) {
+    for (const EmbeddedFile *file = EMBEDDED_FILES; file->name; file++)
+        if (name == file->name)
+            return file;
+    return nullptr;
+}
+
+#else
+
+inline const EmbeddedFile *find_embedded(const std::string &) {
+    return nullptr;
+}
+
+#endif
+
+#endif //CG_EMBEDDED_H
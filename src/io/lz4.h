@@ -0,0 +1,137 @@
+#ifndef CG_LZ4_H
+#define CG_LZ4_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Minimal LZ4 block format codec: greedy single-probe compressor and a
+// bounds-checked decompressor. Output is readable by any LZ4 block decoder.
+namespace lz4 {
+    const int HASH_LOG = 12;
+    const size_t MIN_MATCH = 4;
+    const size_t MF_LIMIT = 12;      // no match may start in the last 12 bytes
+    const size_t LAST_LITERALS = 5;  // the last 5 bytes are always literals
+    const size_t MAX_OFFSET = 65535;
+
+    inline size_t compress_bound(size_t size) {
+        return size + size / 255 + 16;
+    }
+
+    inline uint32_t read32(const uint8_t *p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline uint32_t hash(uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - HASH_LOG);
+    }
+
+    inline uint8_t *write_length(uint8_t *op, size_t length) {
+        for (; length >= 255; length -= 255)
+            *op++ = 255;
+        *op++ = (uint8_t) length;
+        return op;
+    }
+
+    inline uint8_t *write_sequence(uint8_t *op, const uint8_t *literals, size_t literal_length,
+                                   size_t offset, size_t match_length) {
+        uint8_t *token = op++;
+        *token = (uint8_t) ((literal_length >= 15 ? 15 : literal_length) << 4);
+        if (literal_length >= 15)
+            op = write_length(op, literal_length - 15);
+        memcpy(op, literals, literal_length);
+        op += literal_length;
+        if (match_length == 0)
+            return op;
+        *op++ = (uint8_t) offset;
+        *op++ = (uint8_t) (offset >> 8);
+        size_t extra = match_length - MIN_MATCH;
+        *token |= (uint8_t) (extra >= 15 ? 15 : extra);
+        if (extra >= 15)
+            op = write_length(op, extra - 15);
+        return op;
+    }
+
+    // dst must hold compress_bound(size) bytes; returns the compressed size
+    inline size_t compress(const uint8_t *src, size_t size, uint8_t *dst) {
+        // positions are stored +1 so that 0 means empty
+        std::vector<uint32_t> table(1 << HASH_LOG, 0);
+        uint8_t *op = dst;
+        size_t anchor = 0;
+        size_t i = 0;
+        if (size > MF_LIMIT) {
+            size_t limit = size - MF_LIMIT;
+            size_t match_limit = size - LAST_LITERALS;
+            while (i < limit) {
+                uint32_t sequence = read32(src + i);
+                uint32_t h = hash(sequence);
+                size_t ref = table[h];
+                table[h] = (uint32_t) i + 1;
+                if (ref == 0 || i - (ref - 1) > MAX_OFFSET || read32(src + ref - 1) != sequence) {
+                    i++;
+                    continue;
+                }
+                ref--;
+                size_t end = i + MIN_MATCH;
+                while (end < match_limit && src[end] == src[ref + end - i])
+                    end++;
+                op = write_sequence(op, src + anchor, i - anchor, i - ref, end - i);
+                i = anchor = end;
+            }
+        }
+        op = write_sequence(op, src + anchor, size - anchor, 0, 0);
+        return op - dst;
+    }
+
+    inline bool read_length(const uint8_t *&ip, const uint8_t *end, size_t &length) {
+        uint8_t b;
+        do {
+            if (ip >= end)
+                return false;
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+        return true;
+    }
+
+    // false on malformed input or if the output is not exactly dst_size bytes
+    inline bool decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size) {
+        const uint8_t *ip = src;
+        const uint8_t *ip_end = src + src_size;
+        uint8_t *op = dst;
+        uint8_t *op_end = dst + dst_size;
+        while (ip < ip_end) {
+            uint8_t token = *ip++;
+            size_t literal_length = token >> 4;
+            if (literal_length == 15 && !read_length(ip, ip_end, literal_length))
+                return false;
+            if ((size_t) (ip_end - ip) < literal_length || (size_t) (op_end - op) < literal_length)
+                return false;
+            memcpy(op, ip, literal_length);
+            ip += literal_length;
+            op += literal_length;
+            if (ip == ip_end)
+                break;
+            if (ip_end - ip < 2)
+                return false;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            size_t match_length = token & 15;
+            if (match_length == 15 && !read_length(ip, ip_end, match_length))
+                return false;
+            match_length += MIN_MATCH;
+            if (offset == 0 || offset > (size_t) (op - dst) || (size_t) (op_end - op) < match_length)
+                return false;
+            // byte copy: matches may overlap their own output
+            const uint8_t *match = op - offset;
+            for (size_t k = 0; k < match_length; k++)
+                op[k] = match[k];
+            op += match_length;
+        }
+        return op == op_end;
+    }
+}
+
+#endif //CG_LZ4_H
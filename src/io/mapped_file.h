@@ -0,0 +1,93 @@
+#ifndef CG_MAPPED_FILE_H
+#define CG_MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped on destruction.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string &path, bool populate = false) {
+        open(path, populate);
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(MappedFile &&other) noexcept : ptr(other.ptr), len(other.len) {
+        other.ptr = nullptr;
+        other.len = 0;
+    }
+
+    MappedFile &operator=(MappedFile &&other) noexcept {
+        if (this != &other) {
+            close();
+            ptr = other.ptr;
+            len = other.len;
+            other.ptr = nullptr;
+            other.len = 0;
+        }
+        return *this;
+    }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // populate prefaults every page, so later reads never block on disk
+    bool open(const std::string &path, bool populate = false) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+            if (p != MAP_FAILED) {
+                ptr = (const unsigned char *) p;
+                len = st.st_size;
+            }
+        }
+        ::close(fd);
+        return ptr != nullptr;
+    }
+
+    void close() {
+        if (ptr)
+            munmap((void *) ptr, len);
+        ptr = nullptr;
+        len = 0;
+    }
+
+    const unsigned char *data() const {
+        return ptr;
+    }
+
+    size_t size() const {
+        return len;
+    }
+
+    bool is_open() const {
+        return ptr != nullptr;
+    }
+
+private:
+    const unsigned char *ptr = nullptr;
+    size_t len = 0;
+};
+
+// modification time in nanoseconds, or -1 if the file does not exist
+inline long long file_mtime(const std::string &path) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0)
+        return -1;
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+#endif //CG_MAPPED_FILE_H
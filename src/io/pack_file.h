@@ -0,0 +1,148 @@
+#ifndef CG_PACK_FILE_H
+#define CG_PACK_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "lz4.h"
+#include "mapped_file.h"
+
+// Pack file (.pak): header, entry data (16-byte aligned), then an index of
+// fixed-size entries followed by their names.
+const int PACK_VERSION = 1;
+const uint32_t PACK_ENTRY_LZ4 = 1;
+
+struct PackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t index_offset;
+};
+
+struct PackEntry {
+    uint64_t offset;
+    uint64_t stored_size;
+    uint64_t size;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// Read side: the whole pack stays mapped, entries are looked up by name.
+class PackFile {
+public:
+    bool open(const std::string &path) {
+        file = std::make_shared<MappedFile>();
+        if (!file->open(path) || file->size() < sizeof(PackHeader))
+            return false;
+        PackHeader header{};
+        memcpy(&header, file->data(), sizeof(header));
+        if (memcmp(header.magic, "CGPK", 4) != 0 || header.version != PACK_VERSION)
+            return false;
+        size_t index_size = (size_t) header.count * sizeof(PackEntry);
+        if (header.index_offset > file->size() || file->size() - header.index_offset < index_size)
+            return false;
+        const unsigned char *index = file->data() + header.index_offset;
+        const char *names = (const char *) index + index_size;
+        size_t names_size = file->size() - header.index_offset - index_size;
+        for (uint32_t i = 0; i < header.count; i++) {
+            PackEntry entry{};
+            memcpy(&entry, index + i * sizeof(PackEntry), sizeof(entry));
+            if ((size_t) entry.name_offset + entry.name_length > names_size
+                || entry.offset + entry.stored_size > header.index_offset)
+                return false;
+            entries[std::string(names + entry.name_offset, entry.name_length)] = entry;
+        }
+        mtime = file_mtime(path);
+        return true;
+    }
+
+    const PackEntry *find(const std::string &name) const {
+        auto it = entries.find(name);
+        return it == entries.end() ? nullptr : &it->second;
+    }
+
+    const unsigned char *data(const PackEntry &entry) const {
+        return file->data() + entry.offset;
+    }
+
+    // keeps the mapping alive for views handed out by the VFS
+    std::shared_ptr<MappedFile> mapping() const {
+        return file;
+    }
+
+    long long modified() const {
+        return mtime;
+    }
+
+private:
+    std::shared_ptr<MappedFile> file;
+    std::unordered_map<std::string, PackEntry> entries;
+    long long mtime = -1;
+};
+
+// Write side. Each entry is (name inside the pack, source file on disk).
+// With compress set, entries are stored as LZ4 blocks when that saves at
+// least an eighth of their size.
+inline bool build_pack(const std::string &out_path, const std::vector<std::pair<std::string, std::string>> &files,
+                       bool compress) {
+    std::vector<unsigned char> blob(sizeof(PackHeader), 0);
+    std::vector<PackEntry> entries;
+    std::string names;
+    for (const auto &file : files) {
+        MappedFile source(file.second);
+        if (!source.is_open() && file_mtime(file.second) < 0) {
+            fprintf(stderr, "cannot read %s\n", file.second.c_str());
+            return false;
+        }
+        PackEntry entry{};
+        entry.size = source.size();
+        entry.stored_size = source.size();
+        entry.name_offset = (uint32_t) names.size();
+        entry.name_length = (uint32_t) file.first.size();
+        names += file.first;
+        blob.resize((blob.size() + 15) & ~(size_t) 15);
+        entry.offset = blob.size();
+
+        std::vector<unsigned char> packed;
+        if (compress && source.size() > 0) {
+            packed.resize(lz4::compress_bound(source.size()));
+            packed.resize(lz4::compress(source.data(), source.size(), packed.data()));
+            if (packed.size() <= source.size() - source.size() / 8) {
+                entry.stored_size = packed.size();
+                entry.flags |= PACK_ENTRY_LZ4;
+            }
+        }
+        if (entry.flags & PACK_ENTRY_LZ4)
+            blob.insert(blob.end(), packed.begin(), packed.end());
+        else if (source.size() > 0)
+            blob.insert(blob.end(), source.data(), source.data() + source.size());
+        entries.push_back(entry);
+    }
+
+    PackHeader header{};
+    memcpy(header.magic, "CGPK", 4);
+    header.version = PACK_VERSION;
+    header.count = (uint32_t) entries.size();
+    blob.resize((blob.size() + 15) & ~(size_t) 15);
+    header.index_offset = blob.size();
+    memcpy(blob.data(), &header, sizeof(header));
+    const unsigned char *index = (const unsigned char *) entries.data();
+    blob.insert(blob.end(), index, index + entries.size() * sizeof(PackEntry));
+    blob.insert(blob.end(), names.begin(), names.end());
+
+    FILE *f = fopen(out_path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(blob.data(), 1, blob.size(), f) == blob.size();
+    return fclose(f) == 0 && ok;
+}
+
+#endif //CG_PACK_FILE_H
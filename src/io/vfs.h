@@ -0,0 +1,215 @@
+#ifndef CG_VFS_H
+#define CG_VFS_H
+
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "embedded.h"
+#include "mapped_file.h"
+#include "pack_file.h"
+
+// Read-only bytes of one file. Points straight into a mapping unless the
+// entry had to be decompressed; owner keeps the backing storage alive.
+struct FileView {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    bool found = false;
+    std::shared_ptr<const void> owner;
+
+    explicit operator bool() const {
+        return found;
+    }
+
+    std::string str() const {
+        return std::string((const char *) data, size);
+    }
+};
+
+// directory of the running binary, with a trailing slash
+inline std::string executable_dir() {
+    char buf[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (len <= 0)
+        return "";
+    std::string path(buf, len);
+    return path.substr(0, path.rfind('/') + 1);
+}
+
+// Mounts are searched in the order they were added, so mount loose
+// directories before packs to let files on disk override packed ones.
+// Nothing touches the file system until a lookup reaches a mount, so a
+// build whose files are all embedded starts without a single file syscall.
+// Mount everything at startup; lookups are const and safe from any thread.
+class Vfs {
+public:
+    // files compiled in with CG_EMBED_RESOURCES
+    void mount_embedded() {
+        mounts.push_back(Mount{EMBEDDED, "", nullptr});
+    }
+
+    void mount_directory(const std::string &root) {
+        mounts.push_back(Mount{DIRECTORY, with_slash(root), nullptr});
+    }
+
+    // Opened on first use; a missing or corrupt pack is skipped. With
+    // beside_executable the path is relative to the binary's directory.
+    void mount_pack(const std::string &path, bool beside_executable = false) {
+        std::shared_ptr<LazyPack> pack = std::make_shared<LazyPack>();
+        pack->path = path;
+        pack->beside_executable = beside_executable;
+        mounts.push_back(Mount{PACK, "", pack});
+    }
+
+    FileView read(const std::string &name) const {
+        FileView view;
+        for (const Mount &mount : mounts) {
+            if (mount.kind == EMBEDDED) {
+                const EmbeddedFile *file = find_embedded(name);
+                if (file) {
+                    view.data = file->data;
+                    view.size = file->size;
+                    view.found = true;
+                    return view;
+                }
+                continue;
+            }
+            if (mount.kind == PACK) {
+                const PackFile *pack = mount.pack->get();
+                const PackEntry *entry = pack ? pack->find(name) : nullptr;
+                if (entry)
+                    return read_entry(*pack, *entry);
+                continue;
+            }
+            std::string path = mount.root + name;
+            std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+            if (file->open(path, true)) {
+                view.data = file->data();
+                view.size = file->size();
+                view.found = true;
+                view.owner = file;
+                return view;
+            }
+            // mmap refuses empty files
+            if (file_mtime(path) >= 0) {
+                view.found = true;
+                return view;
+            }
+        }
+        return view;
+    }
+
+    // modification time of whatever would serve name (a pack's own time for
+    // packed entries, 0 for embedded ones), -1 if nothing does
+    long long mtime(const std::string &name) const {
+        for (const Mount &mount : mounts) {
+            if (mount.kind == EMBEDDED) {
+                if (find_embedded(name))
+                    return 0;
+                continue;
+            }
+            if (mount.kind == PACK) {
+                const PackFile *pack = mount.pack->get();
+                if (pack && pack->find(name))
+                    return pack->modified();
+                continue;
+            }
+            long long time = file_mtime(mount.root + name);
+            if (time >= 0)
+                return time;
+        }
+        return -1;
+    }
+
+    // where a generated file belongs: the first loose directory, "" if none
+    std::string writable_path(const std::string &name) const {
+        for (const Mount &mount : mounts)
+            if (mount.kind == DIRECTORY)
+                return mount.root + name;
+        return "";
+    }
+
+    // served from the binary itself, taking precedence over every file
+    bool is_embedded(const std::string &name) const {
+        for (const Mount &mount : mounts) {
+            if (mount.kind == EMBEDDED)
+                return find_embedded(name) != nullptr;
+        }
+        return false;
+    }
+
+    bool empty() const {
+        return mounts.empty();
+    }
+
+private:
+    enum Kind {
+        EMBEDDED, DIRECTORY, PACK
+    };
+
+    struct LazyPack {
+        std::string path;
+        bool beside_executable;
+        std::once_flag once;
+        PackFile pack;
+        bool ok = false;
+
+        const PackFile *get() {
+            std::call_once(once, [this] {
+                ok = pack.open(beside_executable ? executable_dir() + path : path);
+            });
+            return ok ? &pack : nullptr;
+        }
+    };
+
+    struct Mount {
+        Kind kind;
+        std::string root;
+        std::shared_ptr<LazyPack> pack;
+    };
+
+    std::vector<Mount> mounts;
+
+    static std::string with_slash(const std::string &root) {
+        if (root.empty() || root.back() == '/')
+            return root;
+        return root + "/";
+    }
+
+    static FileView read_entry(const PackFile &pack, const PackEntry &entry) {
+        FileView view;
+        if (!(entry.flags & PACK_ENTRY_LZ4)) {
+            view.data = pack.data(entry);
+            view.size = entry.size;
+            view.found = true;
+            view.owner = pack.mapping();
+            return view;
+        }
+        std::shared_ptr<std::vector<unsigned char>> bytes = std::make_shared<std::vector<unsigned char>>(entry.size);
+        if (!lz4::decompress(pack.data(entry), entry.stored_size, bytes->data(), bytes->size()))
+            return view;
+        view.data = bytes->data();
+        view.size = bytes->size();
+        view.found = true;
+        view.owner = bytes;
+        return view;
+    }
+};
+
+// Touches every page of view so later readers (e.g. the GL thread copying
+// into an unpack buffer) never block on a page fault.
+inline void prefault(const FileView &view) {
+    volatile unsigned char sink = 0;
+    for (size_t i = 0; i < view.size; i += 4096)
+        sink ^= view.data[i];
+    (void) sink;
+}
+
+inline Vfs &vfs() {
+    static Vfs instance;
+    return instance;
+}
+
+#endif //CG_VFS_H
@@ -0,0 +1,37 @@
+#ifndef CG_LATENCY_TRACKER_H
+#define CG_LATENCY_TRACKER_H
+
+#include <algorithm>
+#include <cstdio>
+#include "log/logger.h"
+
+// Input-to-swap latency: from the first input event folded into a camera
+// snapshot to glfwSwapBuffers returning for the frame that showed it.
+// Display scan-out comes on top of this. Aggregated per report interval.
+class LatencyTracker {
+public:
+    void record(double seconds) {
+        samples++;
+        total += seconds;
+        worst = std::max(worst, seconds);
+        best = samples == 1 ? seconds : std::min(best, seconds);
+    }
+
+    void print() const {
+        if (samples == 0)
+            return;
+        LOG_INFO("input to swap: %.2f ms avg, %.2f ms min, %.2f ms max (%d frames)",
+               1000 * total / samples, 1000 * best, 1000 * worst, samples);
+    }
+
+    void reset() {
+        samples = 0;
+        total = worst = best = 0;
+    }
+
+private:
+    int samples = 0;
+    double total = 0, worst = 0, best = 0;
+};
+
+#endif //CG_LATENCY_TRACKER_H
@@ -0,0 +1,69 @@
+#ifndef CG_LOG_BENCHMARK_H
+#define CG_LOG_BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "logger.h"
+
+// Cost of a LOG_INFO call on the calling thread, per thread count, against
+// printf of the same line to a file. Messages go out in bursts that fit a
+// ring, with pauses for the sink to catch up, so only enqueueing is timed.
+inline void run_log_benchmark() {
+    const int BURST = 256;
+    const int BURSTS = 400;
+    const char *PATH = "log_benchmark.log";
+    Logger::set_console(false);
+    Logger::start(Logger::LEVEL_INFO, PATH, 64 << 20, 1);
+
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    printf("threads  ns/call (async)  ns/call (filtered out)\n");
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        std::vector<double> logged(threads), filtered(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                double ns = 0;
+                for (int burst = 0; burst < BURSTS; burst++) {
+                    auto start = std::chrono::steady_clock::now();
+                    for (int i = 0; i < BURST; i++)
+                        LOG_INFO("frame %d: %zu tiles, %.3f ms, %s", burst, (size_t) i, 1.5 * i, "hex pass");
+                    ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                logged[t] = ns / (BURST * BURSTS);
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < BURST * BURSTS; i++)
+                    LOG_DEBUG("frame %d", i);
+                filtered[t] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+                              / (BURST * BURSTS);
+            });
+        }
+        for (std::thread &worker : workers)
+            worker.join();
+        Logger::flush();
+        double mean = 0, mean_filtered = 0;
+        for (unsigned t = 0; t < threads; t++) {
+            mean += logged[t] / threads;
+            mean_filtered += filtered[t] / threads;
+        }
+        printf("%7u %16.1f %23.2f\n", threads, mean, mean_filtered);
+    }
+    Logger::stop();
+
+    // the same lines formatted on the calling thread
+    FILE *file = fopen(PATH, "w");
+    if (!file)
+        return;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BURST * BURSTS; i++)
+        fprintf(file, "frame %d: %zu tiles, %.3f ms, %s\n", i, (size_t) i, 1.5 * i, "hex pass");
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    fclose(file);
+    remove(PATH);
+    printf("fprintf, 1 thread: %.1f ns/call\n", ns / (BURST * BURSTS));
+}
+
+#endif //CG_LOG_BENCHMARK_H
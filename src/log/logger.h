@@ -0,0 +1,578 @@
+#ifndef CG_LOGGER_H
+#define CG_LOGGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// lowest severity compiled in: 0 debug, 1 info, 2 warning, 3 error
+#ifndef CG_LOG_LEVEL
+#define CG_LOG_LEVEL 0
+#endif
+
+// Asynchronous printf-style logger. A call site only copies the format
+// pointer and its arguments, in binary, into a ring owned by the calling
+// thread; a sink thread formats the records, merged across threads in time
+// order, and writes them to the console (warnings and errors to stderr, the
+// rest to stdout) and optionally a rotated log file. A slow terminal or
+// pipe therefore only holds up the sink. Rings are single producer, single
+// consumer and never block: a full ring drops the record and counts it.
+// A thread's ring is handed to a new thread once it exits; threads beyond
+// MAX_THREADS alive at once get none, and their records are counted too.
+// Formats must be string literals; %s arguments are copied (up to
+// MAX_STRING bytes), so temporaries are fine. Use the LOG_* macros, which
+// compile out below CG_LOG_LEVEL and check formats like printf.
+class Logger {
+public:
+    enum Level {
+        LEVEL_DEBUG,
+        LEVEL_INFO,
+        LEVEL_WARNING,
+        LEVEL_ERROR
+    };
+
+    // bytes per thread ring
+    static const size_t RING_SIZE = 1 << 16;
+    static const int MAX_THREADS = 64;
+    static const size_t MAX_STRING = 1023;
+
+    // Starts the sink. path, if given, receives every line with a time,
+    // level and thread prefix and is rotated to path.1 .. path.<files - 1>
+    // once it grows past file_bytes.
+    static void start(Level level, const char *path = nullptr, size_t file_bytes = 8 << 20, int files = 3) {
+        State &s = state();
+        set_level(level);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.running)
+            return;
+        if (path) {
+            s.path = path;
+            s.file_bytes = file_bytes;
+            s.files = files;
+            s.file = fopen(path, "w");
+            if (!s.file)
+                fprintf(stderr, "cannot write log %s\n", path);
+        }
+        s.running = true;
+        s.sink = std::thread(run);
+    }
+
+    // drains everything logged so far and stops the sink
+    static void stop() {
+        State &s = state();
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (!s.running)
+                return;
+            s.running = false;
+        }
+        s.wake.notify_one();
+        s.sink.join();
+        if (s.file)
+            fclose(s.file);
+        s.file = nullptr;
+    }
+
+    // returns once what the calling thread logged before is written
+    static void flush() {
+        State &s = state();
+        std::unique_lock<std::mutex> lock(s.mutex);
+        if (!s.running)
+            return;
+        uint64_t ticket = ++s.flush_requested;
+        s.wake.notify_one();
+        s.flushed.wait(lock, [&] { return s.flush_done >= ticket || !s.running; });
+    }
+
+    // console output on or off; the file, if any, gets every line regardless
+    static void set_console(bool console) {
+        state().console.store(console, std::memory_order_relaxed);
+    }
+
+    static void set_level(Level level) {
+        state().level.store(level, std::memory_order_relaxed);
+    }
+
+    static bool enabled(Level level) {
+        return level >= state().level.load(std::memory_order_relaxed);
+    }
+
+    template<typename... Args>
+    static void write(Level level, const char *format, const Args &... args) {
+        Ring *ring = local();
+        if (!ring) {
+            state().unlogged.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        size_t size = align(sizeof(Header) + arguments_size(args...));
+        unsigned char *at = ring->reserve(size);
+        if (!at) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Header header{(uint32_t) size, (uint8_t) level, (uint8_t) sizeof...(Args), format, now()};
+        memcpy(at, &header, sizeof(header));
+        unsigned char *arg = at + sizeof(header);
+        int unused[] = {0, (put(arg, args), 0)...};
+        (void) unused;
+        (void) arg;
+        ring->commit();
+    }
+
+private:
+    static const uint8_t PADDING = 0xff;
+    static const size_t PADDING_BYTES = 8;
+
+    enum Tag : uint8_t {
+        INT,
+        UINT,
+        LONG,
+        ULONG,
+        LLONG,
+        ULLONG,
+        DOUBLE,
+        STRING,
+        POINTER
+    };
+
+    struct Header {
+        // of the whole record, header included, a multiple of 8
+        uint32_t size;
+        uint8_t level;
+        uint8_t arguments;
+        const char *format;
+        uint64_t time;
+    };
+
+    static_assert(offsetof(Header, level) < PADDING_BYTES, "padding records hold size and level");
+
+    // One thread writes, the sink reads. Positions only grow; a record
+    // never wraps, the space left at the end is skipped with a padding
+    // header instead.
+    struct Ring {
+        std::unique_ptr<unsigned char[]> data{new unsigned char[RING_SIZE]};
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+        // producer only
+        uint64_t reserved = 0;
+        int index = 0;
+        // its thread exited, a new one may take over; under State::mutex
+        bool free = false;
+
+        unsigned char *reserve(size_t size) {
+            uint64_t start = head.load(std::memory_order_relaxed);
+            size_t offset = start % RING_SIZE;
+            size_t padding = RING_SIZE - offset < size ? RING_SIZE - offset : 0;
+            if (start + padding + size - tail.load(std::memory_order_acquire) > RING_SIZE)
+                return nullptr;
+            if (padding) {
+                // as little as 8 bytes may be left: only size and level are written
+                Header pad{(uint32_t) padding, PADDING, 0, nullptr, 0};
+                memcpy(&data[offset], &pad, PADDING_BYTES);
+                offset = 0;
+            }
+            reserved = start + padding + size;
+            return &data[offset];
+        }
+
+        void commit() {
+            head.store(reserved, std::memory_order_release);
+        }
+    };
+
+    struct State {
+        std::atomic<int> level{LEVEL_INFO};
+        std::atomic<bool> console{true};
+        Ring *rings[MAX_THREADS]{};
+        std::atomic<int> ring_count{0};
+        // records of threads that found every ring taken
+        std::atomic<uint64_t> unlogged{0};
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable flushed;
+        uint64_t flush_requested = 0;
+        uint64_t flush_done = 0;
+        bool running = false;
+        std::thread sink;
+        std::string path;
+        FILE *file = nullptr;
+        size_t file_bytes = 0;
+        size_t file_written = 0;
+        int files = 0;
+    };
+
+    static State &state() {
+        static State s;
+        return s;
+    }
+
+    // nanoseconds since the first call
+    static uint64_t now() {
+        static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - origin).count();
+    }
+
+    static size_t align(size_t size) {
+        return (size + 7) & ~(size_t) 7;
+    }
+
+    // hands the thread's ring back at thread exit; records still in it are
+    // drained as usual, and later calls from this thread are not logged
+    struct Release {
+        Ring *&ring;
+
+        ~Release() {
+            if (!ring)
+                return;
+            std::lock_guard<std::mutex> lock(state().mutex);
+            ring->free = true;
+            ring = nullptr;
+        }
+    };
+
+    // null when every ring is taken by a live thread
+    static Ring *local() {
+        thread_local Ring *ring = nullptr;
+        thread_local bool registered = false;
+        if (!registered) {
+            registered = true;
+            ring = acquire();
+            thread_local Release release{ring};
+        }
+        return ring;
+    }
+
+    // a ring left by an exited thread, else a new one while there is room;
+    // the mutex orders the old producer's writes before the new one's
+    static Ring *acquire() {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        int count = s.ring_count.load(std::memory_order_relaxed);
+        for (int i = 0; i < count; i++) {
+            if (s.rings[i]->free) {
+                s.rings[i]->free = false;
+                return s.rings[i];
+            }
+        }
+        if (count == MAX_THREADS)
+            return nullptr;
+        Ring *ring = new Ring();
+        ring->index = count;
+        s.rings[count] = ring;
+        s.ring_count.store(count + 1, std::memory_order_release);
+        return ring;
+    }
+
+    // argument encoding: a tag byte and the value as varargs would pass it
+    static size_t arguments_size() {
+        return 0;
+    }
+
+    template<typename T, typename... Rest>
+    static size_t arguments_size(const T &value, const Rest &... rest) {
+        return size(value) + arguments_size(rest...);
+    }
+
+    static size_t size(int) { return 1 + sizeof(int); }
+    static size_t size(unsigned) { return 1 + sizeof(unsigned); }
+    static size_t size(long) { return 1 + sizeof(long); }
+    static size_t size(unsigned long) { return 1 + sizeof(unsigned long); }
+    static size_t size(long long) { return 1 + sizeof(long long); }
+    static size_t size(unsigned long long) { return 1 + sizeof(unsigned long long); }
+    static size_t size(double) { return 1 + sizeof(double); }
+    static size_t size(const void *) { return 1 + sizeof(const void *); }
+
+    static size_t size(const char *value) {
+        return 1 + sizeof(uint16_t) + (value ? strnlen(value, MAX_STRING) : 0);
+    }
+
+    template<typename T>
+    static void put_value(unsigned char *&at, Tag tag, T value) {
+        *at++ = tag;
+        memcpy(at, &value, sizeof(value));
+        at += sizeof(value);
+    }
+
+    static void put(unsigned char *&at, int value) { put_value(at, INT, value); }
+    static void put(unsigned char *&at, unsigned value) { put_value(at, UINT, value); }
+    static void put(unsigned char *&at, long value) { put_value(at, LONG, value); }
+    static void put(unsigned char *&at, unsigned long value) { put_value(at, ULONG, value); }
+    static void put(unsigned char *&at, long long value) { put_value(at, LLONG, value); }
+    static void put(unsigned char *&at, unsigned long long value) { put_value(at, ULLONG, value); }
+    static void put(unsigned char *&at, double value) { put_value(at, DOUBLE, value); }
+    static void put(unsigned char *&at, const void *value) { put_value(at, POINTER, value); }
+
+    static void put(unsigned char *&at, const char *value) {
+        uint16_t length = (uint16_t) (value ? strnlen(value, MAX_STRING) : 0);
+        *at++ = STRING;
+        memcpy(at, &length, sizeof(length));
+        at += sizeof(length);
+        if (length)
+            memcpy(at, value, length);
+        at += length;
+    }
+
+    // sink thread
+
+    static void run() {
+        State &s = state();
+        while (true) {
+            uint64_t flush_ticket;
+            bool running;
+            {
+                std::unique_lock<std::mutex> lock(s.mutex);
+                // polled: waking the sink from every call site would cost a syscall
+                s.wake.wait_for(lock, std::chrono::milliseconds(5),
+                                [&] { return !s.running || s.flush_requested > s.flush_done; });
+                flush_ticket = s.flush_requested;
+                running = s.running;
+            }
+            drain();
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.flush_done = flush_ticket;
+            }
+            s.flushed.notify_all();
+            if (!running)
+                return;
+        }
+    }
+
+    // writes out every committed record, oldest first across threads
+    static void drain() {
+        State &s = state();
+        int count = s.ring_count.load(std::memory_order_acquire);
+        bool wrote = false;
+        while (true) {
+            Ring *oldest = nullptr;
+            const Header *next = nullptr;
+            for (int i = 0; i < count; i++) {
+                const Header *header = peek(*s.rings[i]);
+                if (header && (!next || header->time < next->time)) {
+                    oldest = s.rings[i];
+                    next = header;
+                }
+            }
+            if (!next)
+                break;
+            emit(*next, oldest->index);
+            oldest->tail.store(oldest->tail.load(std::memory_order_relaxed) + next->size, std::memory_order_release);
+            wrote = true;
+        }
+        for (int i = 0; i < count; i++) {
+            uint64_t dropped = s.rings[i]->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped) {
+                char line[96];
+                snprintf(line, sizeof(line), "log: %llu messages of thread %d dropped, ring full\n",
+                         (unsigned long long) dropped, i);
+                output(line, line, strlen(line), LEVEL_WARNING);
+                wrote = true;
+            }
+        }
+        uint64_t unlogged = s.unlogged.exchange(0, std::memory_order_relaxed);
+        if (unlogged) {
+            char line[96];
+            snprintf(line, sizeof(line), "log: %llu messages dropped, more than %d threads logging\n",
+                     (unsigned long long) unlogged, MAX_THREADS);
+            output(line, line, strlen(line), LEVEL_WARNING);
+            wrote = true;
+        }
+        if (wrote) {
+            fflush(stdout);
+            if (s.file)
+                fflush(s.file);
+        }
+    }
+
+    // next record of ring, padding skipped; null if there is none
+    static const Header *peek(Ring &ring) {
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        while (tail < head) {
+            const Header *header = (const Header *) &ring.data[tail % RING_SIZE];
+            if (header->level != PADDING)
+                return header;
+            tail += header->size;
+            ring.tail.store(tail, std::memory_order_release);
+        }
+        return nullptr;
+    }
+
+    static void emit(const Header &header, int thread) {
+        static char line[4096];
+        static const char LEVELS[] = "DIWE";
+        int prefix = snprintf(line, sizeof(line), "%10.4f %c t%-2d ", header.time / 1e9, LEVELS[header.level], thread);
+        size_t length = prefix;
+        // console lines carry a prefix only when they are not plain information
+        const char *message = line + prefix;
+        if (header.level >= LEVEL_WARNING) {
+            const char *label = header.level == LEVEL_WARNING ? "warning: " : "error: ";
+            length += snprintf(line + length, sizeof(line) - length, "%s", label);
+        }
+        length += format(line + length, sizeof(line) - length - 1, header);
+        if (length > sizeof(line) - 2)
+            length = sizeof(line) - 2;
+        if (length == 0 || line[length - 1] != '\n')
+            line[length++] = '\n';
+        line[length] = 0;
+        output(line, message, length, (Level) header.level);
+    }
+
+    // the whole line goes to the file, from message on to the console:
+    // stderr for warnings and errors, so they survive redirecting stdout
+    static void output(const char *line, const char *message, size_t length, Level level) {
+        State &s = state();
+        if (s.console.load(std::memory_order_relaxed)) {
+            if (level >= LEVEL_WARNING) {
+                // stdout is buffered; keep the console in time order
+                fflush(stdout);
+                fwrite(message, 1, length - (message - line), stderr);
+            } else {
+                fwrite(message, 1, length - (message - line), stdout);
+            }
+        }
+        if (!s.file)
+            return;
+        fwrite(line, 1, length, s.file);
+        s.file_written += length;
+        if (s.file_written > s.file_bytes)
+            rotate();
+    }
+
+    static void rotate() {
+        State &s = state();
+        fclose(s.file);
+        char from[512], to[512];
+        for (int i = s.files - 1; i > 0; i--) {
+            if (i == 1)
+                snprintf(from, sizeof(from), "%s", s.path.c_str());
+            else
+                snprintf(from, sizeof(from), "%s.%d", s.path.c_str(), i - 1);
+            snprintf(to, sizeof(to), "%s.%d", s.path.c_str(), i);
+            rename(from, to);
+        }
+        s.file = fopen(s.path.c_str(), "w");
+        s.file_written = 0;
+    }
+
+    // printf of the record's format with its captured arguments
+    static size_t format(char *out, size_t capacity, const Header &header) {
+        const unsigned char *arg = (const unsigned char *) (&header + 1);
+        int left = header.arguments;
+        size_t length = 0;
+        for (const char *f = header.format; *f && length < capacity; f++) {
+            if (*f != '%') {
+                out[length++] = *f;
+                continue;
+            }
+            if (f[1] == '%') {
+                out[length++] = '%';
+                f++;
+                continue;
+            }
+            // one conversion: flags, width, precision, length, specifier
+            char spec[32];
+            size_t n = 0;
+            spec[n++] = *f++;
+            while (*f && !strchr("diouxXeEfFgGaAcspn", *f) && n < sizeof(spec) - 2)
+                spec[n++] = *f++;
+            if (!*f)
+                break;
+            spec[n++] = *f;
+            spec[n] = 0;
+            if (left-- == 0 || *f == 'n')
+                continue;
+            length += print_argument(out + length, capacity - length, spec, arg);
+        }
+        return std::min(length, capacity);
+    }
+
+    static size_t print_argument(char *out, size_t capacity, const char *spec, const unsigned char *&arg) {
+        Tag tag = (Tag) *arg++;
+        int n = 0;
+        switch (tag) {
+            case INT:
+                n = snprintf(out, capacity, spec, take<int>(arg));
+                break;
+            case UINT:
+                n = snprintf(out, capacity, spec, take<unsigned>(arg));
+                break;
+            case LONG:
+                n = snprintf(out, capacity, spec, take<long>(arg));
+                break;
+            case ULONG:
+                n = snprintf(out, capacity, spec, take<unsigned long>(arg));
+                break;
+            case LLONG:
+                n = snprintf(out, capacity, spec, take<long long>(arg));
+                break;
+            case ULLONG:
+                n = snprintf(out, capacity, spec, take<unsigned long long>(arg));
+                break;
+            case DOUBLE:
+                n = snprintf(out, capacity, spec, take<double>(arg));
+                break;
+            case POINTER:
+                n = snprintf(out, capacity, spec, take<const void *>(arg));
+                break;
+            case STRING: {
+                uint16_t size = take<uint16_t>(arg);
+                char text[MAX_STRING + 1];
+                memcpy(text, arg, size);
+                text[size] = 0;
+                arg += size;
+                n = snprintf(out, capacity, spec, text);
+                break;
+            }
+        }
+        return n < 0 ? 0 : std::min((size_t) n, capacity ? capacity - 1 : 0);
+    }
+
+    template<typename T>
+    static T take(const unsigned char *&at) {
+        T value;
+        memcpy(&value, at, sizeof(value));
+        at += sizeof(value);
+        return value;
+    }
+};
+
+// The printf in the dead branch only makes the compiler check the format
+// against the arguments; nothing is printed through it.
+#define CG_LOG(level, ...) \
+    do { \
+        if (false) \
+            printf(__VA_ARGS__); \
+        else if (Logger::enabled(level)) \
+            Logger::write(level, __VA_ARGS__); \
+    } while (0)
+
+#if CG_LOG_LEVEL <= 0
+#define LOG_DEBUG(...) CG_LOG(Logger::LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+#if CG_LOG_LEVEL <= 1
+#define LOG_INFO(...) CG_LOG(Logger::LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+#if CG_LOG_LEVEL <= 2
+#define LOG_WARNING(...) CG_LOG(Logger::LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) do {} while (0)
+#endif
+#define LOG_ERROR(...) CG_LOG(Logger::LEVEL_ERROR, __VA_ARGS__)
+
+#endif //CG_LOGGER_H
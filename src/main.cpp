@@ -1,6 +1,8 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include <cmath>
 #include <stb_image/stb_image.h>
 #include <glm/glm.hpp>
@@ -10,18 +12,47 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "shader.h"
-#include "camera/look_at_camera.h"
-#include "camera/fps_camera.h"
-#include "fps_camera_controller.h"
-#include "camera/arcball_camera.h"
-#include "arcball_camera_controller.h"
 #include "utils.h"
 #include "hexagons.h"
+#include "camera_input.h"
+#include "options.h"
+#include "simulation.h"
+#include "threading/job_system.h"
+#include "threading/job_benchmark.h"
+#include "texture/async_texture_loader.h"
+#include "texture/texture_array.h"
+#include "gl/camera_buffer.h"
+#include "latency_tracker.h"
+#include "frame_pacer.h"
+#include "redraw_signal.h"
+#include "gl/upload_thread.h"
+#include "gl/command_list.h"
+#include "gl/state_cache.h"
+#include "gl/command_benchmark.h"
+#include "gl/gpu_timer.h"
+#include "gl/gpu_memory.h"
+#include "gl/gl_capture.h"
+#include "log/logger.h"
+#include "log/log_benchmark.h"
+#include "frame_scheduler.h"
+#include "profiling/trace.h"
+#include "profiling/alloc_tracker.h"
+#include "profiling/counters.h"
+#include "profiling/metrics_server.h"
+#include "profiling/startup_profiler.h"
+#include "ui/overlay.h"
 
 using namespace glm;
 
-int SCR_WIDTH = 800;
-int SCR_HEIGHT = 800;
+// framebuffer size, written by the event thread
+std::atomic<int> SCR_WIDTH{800};
+std::atomic<int> SCR_HEIGHT{800};
+// event thread ticks per second: camera integration and publishing
+const double INPUT_RATE = 1000;
+// on demand, longest the event thread sleeps without input
+const double IDLE_WAIT = 0.25;
+// hexagon rings when the field has to settle, about two minutes of unfolding
+const int HEX_SETTLED_DEPTH = 40;
 
 static void error_callback(int error, const char *description);
 
@@ -31,38 +62,68 @@ static void cursor_position_callback(GLFWwindow *window, double xpos, double ypo
 
 static void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 
-static void load2DTexture(uint &id, const std::string &path, bool alpha = false);
-
 static void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
 
-static void process_input(GLFWwindow *window);
+static unsigned held_keys(GLFWwindow *window);
 
-static void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+static void render(GLFWwindow *window, GLFWwindow *uploadWindow);
 
-LookAtCamera look_at_camera(vec3(0, 0, 3), vec3(0, 0, 0), vec3(0, 1, 0));
-FPSCamera fps_camera(vec3(0, 0, 3));
-FPSCameraController fps_controller(&fps_camera);
-ArcballCamera arcball_camera(identity<quat>(), vec3(0, 0, 0), vec3(0, 0, 5));
-ArcballCameraController arcball_controller(&arcball_camera, SCR_WIDTH, SCR_HEIGHT);
-float timestamp;
-float loop_deltatime;
-double last_mouse_x, last_mouse_y;
+static void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 
+static void refresh_callback(GLFWwindow *window);
 
-mat4 global_view;
-mat4 global_proj;
+static void wait_events(double timeout);
 
+// toggled on the event thread, read by the render thread
 struct {
-    GLenum PolygonMode = GL_FILL;
-    bool drawPoints = true;
+    std::atomic<GLenum> PolygonMode{GL_FILL};
+    std::atomic<bool> drawPoints{true};
+    std::atomic<bool> drawScene{false};
+    std::atomic<bool> reloadShaders{false};
+    std::atomic<bool> toggleTrace{false};
 } settings;
 
 
+Options options;
 HexagonAnimation *hexAnim;
-
-int main() {
+// created by the render thread once GL is up
+std::atomic<Simulation *> simulation{nullptr};
+CameraInput *cameraInput;
+// F1: profiler overlay, which takes the mouse while shown
+OverlayInput overlayInput;
+// raised by whatever changes the picture, for --on-demand
+RedrawSignal redraw;
+// bumped on every key event and overlay edit; frames that follow are not
+// steady state yet
+std::atomic<unsigned> keyEvents{0};
+// frames after the last key event before allocation checks apply
+const long ALLOC_WARMUP_FRAMES = 120;
+
+int main(int argc, char **argv) {
+    StartupProfiler::start();
+    if (!parse_options(argc, argv, options))
+        return 1;
+    if (options.bench_jobs) {
+        run_job_benchmark();
+        return 0;
+    }
+    if (options.bench_commands) {
+        run_command_benchmark();
+        return 0;
+    }
+    if (options.bench_log) {
+        run_log_benchmark();
+        return 0;
+    }
+    Trace::name_thread("events");
+    StartupSteps startup;
+    // everything after this logs through the sink thread; drained at exit
+    Logger::start(options.log_level, options.log_file);
+    atexit(Logger::stop);
+    startup.step("options and logger");
     glfwSetErrorCallback(error_callback);
     glfwInit();
+    startup.step("glfw init");
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -71,40 +132,138 @@ int main() {
     GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "OpenGL", NULL, NULL);
     //glfwMaximizeWindow(window);
     if (window == nullptr) {
-        std::cout << "Failed to create GLFW window" << std::endl;
+        LOG_ERROR("failed to create GLFW window");
+        glfwTerminate();
+        return -1;
+    }
+    startup.step("window");
+    // hidden window whose context shares objects with the main one, for
+    // the upload thread
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *uploadWindow = glfwCreateWindow(1, 1, "upload", NULL, window);
+    if (uploadWindow == nullptr) {
+        LOG_ERROR("failed to create upload context");
         glfwTerminate();
         return -1;
     }
+    startup.step("upload context");
     glfwSetKeyCallback(window, key_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(window, cursor_position_callback);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetWindowRefreshCallback(window, refresh_callback);
+    glfwSetWindowCloseCallback(window, refresh_callback);
+
+    // embedded files first, then loose files under the working directory
+    // overriding the packed ones
+#ifdef CG_EMBED_RESOURCES
+    vfs().mount_embedded();
+#endif
+    vfs().mount_directory(".");
+    vfs().mount_pack("data.pak", true);
+    vfs().mount_pack("data.pak");
+    startup.step("mount files");
+
+    // This thread only pumps events and integrates the cameras at a fixed
+    // rate; all GL work happens on the render thread, so a slow frame never
+    // delays input.
+    CameraInput input(SCR_WIDTH, SCR_HEIGHT);
+    cameraInput = &input;
+    std::thread renderThread(render, window, uploadWindow);
+    const double period = 1.0 / INPUT_RATE;
+    double last = glfwGetTime();
+    double next = last;
+    while (!glfwWindowShouldClose(window)) {
+        double now;
+        if (options.on_demand && held_keys(window) == 0) {
+            // nothing to integrate: sleep until input arrives, then handle
+            // it right away
+            wait_events(IDLE_WAIT);
+            now = glfwGetTime();
+            next = last = now;
+        } else {
+            next += period;
+            now = glfwGetTime();
+            while (now < next) {
+                wait_events(next - now);
+                now = glfwGetTime();
+            }
+            // fell behind (e.g. a modal window drag), skip the missed ticks
+            if (now - next > period)
+                next = now;
+        }
+        if (input.update(held_keys(window), (float) (now - last), now) && options.on_demand)
+            redraw.request();
+        last = now;
+    }
+    // wake the render thread so it sees the close
+    redraw.request();
+    renderThread.join();
+    if (simulation)
+        simulation.load()->stop();
+    glfwTerminate();
+    return 0;
+}
+
+static void render(GLFWwindow *window, GLFWwindow *uploadWindow) {
+    Trace::name_thread("render");
+    StartupSteps startup;
     glfwMakeContextCurrent(window);
-    // glfwSwapInterval(0);
+    // released after every GL object below has been destroyed; whatever
+    // buffer or texture is still registered then has leaked
+    struct ContextGuard {
+        ~ContextGuard() {
+            GpuMemory::report_leaks();
+            glfwMakeContextCurrent(nullptr);
+        }
+    } contextGuard;
     if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        LOG_ERROR("failed to initialize GLAD");
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+        return;
     }
+    // from here on, so the capture holds the setup its frames depend on
+    if (options.capture_file)
+        GLCapture::start(options.capture_file);
+    startup.step("gl context");
+    FramePacer::set_swap_interval(options.swap_interval);
+    FramePacer pacer(options.frames_in_flight, options.target_fps);
 
     Shader rainbowShader("shaders/rainbowShader.vs", "shaders/rainbowShader.fs");
     Shader posColorShader("shaders/posColor.vs", "shaders/posColor.fs");
     Shader planeShader("shaders/texture.vs", "shaders/texture.fs");
-    uint planeModelUniform = glGetUniformLocation(planeShader.ID, "model");
-    uint planeViewUniform = glGetUniformLocation(planeShader.ID, "view");
-    uint planeProjUniform = glGetUniformLocation(planeShader.ID, "projection");
     Shader cubeShader("shaders/3D.vs", "shaders/3D.fs");
-    uint cubeModelUniform = glGetUniformLocation(cubeShader.ID, "model");
-    uint cubeViewUniform = glGetUniformLocation(cubeShader.ID, "view");
-    uint cubeProjUniform = glGetUniformLocation(cubeShader.ID, "projection");
     Shader pointsShader("shaders/point.vs", "shaders/point.fs");
-    uint pointsModelUniform = glGetUniformLocation(pointsShader.ID, "model");
-    uint pointsViewUniform = glGetUniformLocation(pointsShader.ID, "view");
-    uint pointsProjUniform = glGetUniformLocation(pointsShader.ID, "projection");
     Shader hexShader("shaders/hex.vs", "shaders/hex.fs");
-    uint hexView = glGetUniformLocation(hexShader.ID, "view");
-    uint hexProj = glGetUniformLocation(hexShader.ID, "proj");
+    Shader overlayShader("shaders/overlay.vs", "shaders/overlay.fs");
+    Shader *shaders[] = {&rainbowShader, &posColorShader, &planeShader, &cubeShader, &pointsShader, &hexShader,
+                         &overlayShader};
+    startup.step("shaders");
+    Overlay overlay;
+    startup.step("overlay");
+    // uniform locations and bindings, looked up again after a reload
+    GLint planeModelUniform, planeLayersUniform, hexView, hexProj;
+    auto configure = [&] {
+        planeModelUniform = glGetUniformLocation(planeShader.ID, "model");
+        planeLayersUniform = glGetUniformLocation(planeShader.ID, "layers");
+        hexView = glGetUniformLocation(hexShader.ID, "view");
+        hexProj = glGetUniformLocation(hexShader.ID, "proj");
+        // view and projection of every pass but the hexagons come from one block
+        CameraBuffer::bind_block(planeShader.ID);
+        CameraBuffer::bind_block(cubeShader.ID);
+        CameraBuffer::bind_block(pointsShader.ID);
+        planeShader.use();
+        planeShader.setInt("texArray", 0);
+        cubeShader.use();
+        cubeShader.setInt("texArray", 0);
+        if (hexAnim)
+            hexAnim->set_shader(hexShader);
+        overlay.set_shader(overlayShader);
+    };
+    configure();
+    CameraBuffer cameraBuffer;
 
     // plane
     float plane[] = {
@@ -123,25 +282,27 @@ int main() {
             1, 2, 3
     };
 
-    uint planeVAO, planeVBO, planeEBO;
-    glGenVertexArrays(1, &planeVAO);
-    glGenBuffers(1, &planeVBO);
-    glGenBuffers(1, &planeEBO);
-
-    glBindVertexArray(planeVAO);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(order), order, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(plane), plane, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 32, 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 32, (void *) (3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 32, (void *) (6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    // Static geometry is uploaded by the upload thread; vertex arrays are
+    // per context, so they are built here once the buffers are done and
+    // passes skip drawing until then.
+    UploadThread uploads(uploadWindow);
+    uint planeVAO = 0, planeVBO = 0, planeEBO = 0;
+    uploads.submit([&planeVBO, &planeEBO, plane, order](UploadContext &context) {
+        planeEBO = context.create_buffer("plane", order, sizeof(order));
+        planeVBO = context.create_buffer("plane", plane, sizeof(plane));
+    }, [&planeVAO, &planeVBO, &planeEBO] {
+        glGenVertexArrays(1, &planeVAO);
+        glBindVertexArray(planeVAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeEBO);
+        glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 32, 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 32, (void *) (3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 32, (void *) (6 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+        glBindVertexArray(0);
+    });
 
     // cube data
     float cube[] = {
@@ -176,33 +337,87 @@ int main() {
             -0.5, -0.5, -0.5, 0, 1,
             -0.5, -0.5, 0.5, 1, 1,
     };
-    uint cubeVAO, cubeVBO;
-    glGenVertexArrays(1, &cubeVAO);
-    glGenBuffers(1, &cubeVBO);
-
-    glBindVertexArray(cubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cube), cube, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 20, (void *) 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 20, (void *) 12);
-    glEnableVertexAttribArray(1);
-
-    // textures
-    uint woodTexture, eyeTexture;
-    load2DTexture(woodTexture, "assets/container.jpg");
-    load2DTexture(eyeTexture, "assets/triangle.png", true);
-    planeShader.use();
-    planeShader.setInt("texSampler0", 0);
-    planeShader.setInt("texSampler1", 1);
-    cubeShader.use();
-    cubeShader.setInt("texSampler0", 0);
-    cubeShader.setInt("texSampler1", 1);
-
-    // animations
-    hexAnim = new HexagonAnimation(global_view, global_proj);
+    // per-instance model matrix and texture layers, shared by cube and point
+    // shaders; rewritten every frame, so it stays on this thread
+    struct CubeInstance {
+        mat4 model;
+        vec2 layers;
+    };
+    uint cubeInstanceVBO;
+    glGenBuffers(1, &cubeInstanceVBO);
+
+    uint cubeVAO = 0, cubeVBO = 0;
+    uploads.submit([&cubeVBO, cube](UploadContext &context) {
+        cubeVBO = context.create_buffer("cube", cube, sizeof(cube));
+    }, [&cubeVAO, &cubeVBO, cubeInstanceVBO] {
+        glGenVertexArrays(1, &cubeVAO);
+        glBindVertexArray(cubeVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 20, (void *) 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 20, (void *) 12);
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, cubeInstanceVBO);
+        for (int column = 0; column < 4; column++) {
+            glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(CubeInstance),
+                                  (void *) (column * sizeof(vec4)));
+            glEnableVertexAttribArray(2 + column);
+            glVertexAttribDivisor(2 + column, 1);
+        }
+        glVertexAttribPointer(6, 2, GL_FLOAT, GL_FALSE, sizeof(CubeInstance),
+                              (void *) offsetof(CubeInstance, layers));
+        glEnableVertexAttribArray(6);
+        glVertexAttribDivisor(6, 1);
+        glBindVertexArray(0);
+    });
+
+    // textures, all layers of one array bound once for every pass
+    startup.step("static geometry");
+    JobSystem jobs;
+    AsyncTextureLoader textureLoader(jobs, uploads);
+    TextureArray textureArray(512, 512, 16);
+    const TextureLayer *woodTexture = textureLoader.load_layer(textureArray, "assets/container.jpg");
+    const TextureLayer *eyeTexture = textureLoader.load_layer(textureArray, "assets/triangle.png", true, true);
+    Material materials[] = {
+            {woodTexture, eyeTexture},
+            {eyeTexture, woodTexture}
+    };
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray.id);
+
+    // animations, advanced by the simulation thread from here on
+    startup.step("textures");
+    // On demand the field must come to rest for the loop to idle, and with
+    // --assert-no-alloc its buffers must not grow; otherwise it unfolds on.
+    hexAnim = options.on_demand || options.assert_no_alloc ? new HexagonAnimation(HEX_SETTLED_DEPTH)
+                                                           : new HexagonAnimation();
+    hexAnim->upload(uploads);
+    hexAnim->set_shader(hexShader);
     hexAnim->reset();
+    startup.step("hexagons");
+    Simulation *sim = new Simulation(hexAnim);
+    if (options.on_demand) {
+        sim->redraw = &redraw;
+        sim->idle_when_settled = true;
+    }
+    sim->set_spin_visible(settings.drawScene);
+    sim->start();
+    simulation = sim;
+    startup.step("simulation");
+    std::vector<CubeInstance> cubes;
+    // Passes are recorded into command lists, the hex tiles in parallel on
+    // the job system, and replayed here in one go.
+    GLStateCache stateCache;
+    CommandList sceneCommands;
+    ParallelCommandLists hexCommands;
+    const size_t HEX_TILES_PER_LIST = 256;
+    // heavy one-off GL work, sliced into what is left of each frame
+    FrameScheduler scheduler;
+    const double frameBudget = options.frame_budget > 0 ? options.frame_budget / 1000
+                                                        : 1.0 / (options.target_fps > 0 ? options.target_fps : 60);
+    float hexRadius = hexAnim->R;
+    // GPU time per pass, read back a few frames late
+    GpuTimer gpuTimer;
 
     glLineWidth(2);
     glEnable(GL_DEPTH_TEST);
@@ -210,144 +425,310 @@ int main() {
     //glEnable(GL_MULTISAMPLE);
     int frames_cnt = 0;
     double last_fps_time = 0;
+    int viewport_width = 0, viewport_height = 0;
+    LatencyTracker latency;
+    double last_input_time = 0;
+    // --trace-frames range, F9 toggles a capture
+    TraceCapture traceCapture(options.trace_first, options.trace_last);
+    long frame = 0;
+    AllocMonitor allocs(options.assert_no_alloc);
+    unsigned lastKeyEvents = keyEvents;
+    long steadySince = 0;
+    // last overlay edit, shown until a packet made after it arrives
+    SceneParams tunedParams;
+    uint64_t tunedFrame = 0;
+    bool tuned = false;
+    // --counters-csv: one row of counters per frame
+    FILE *countersCsv = nullptr;
+    if (options.counters_csv) {
+        countersCsv = fopen(options.counters_csv, "w");
+        if (countersCsv)
+            Counters::write_csv_header(countersCsv);
+        else
+            LOG_ERROR("cannot write counters to %s", options.counters_csv);
+    }
+    // --metrics-socket: live metrics for anything that connects
+    MetricsServer metrics;
+    MetricsSnapshot metricsSnapshot;
+    if (options.metrics_socket)
+        metrics.start(options.metrics_socket);
+    startup.step("render setup");
+    double lastFrameStart = glfwGetTime();
     while (!glfwWindowShouldClose(window)) {
+        if (options.on_demand) {
+            redraw.wait();
+            if (glfwWindowShouldClose(window))
+                break;
+        }
+        traceCapture.begin_frame(frame++, settings.toggleTrace.exchange(false));
+        TRACE_ZONE("frame");
+        allocs.begin_frame();
+        pacer.begin_frame();
+        double frameStart = glfwGetTime();
+        gpuTimer.begin_frame();
+        int gpuFrame = gpuTimer.begin("frame");
+        int width = SCR_WIDTH, height = SCR_HEIGHT;
+        if (width != viewport_width || height != viewport_height) {
+            glViewport(0, 0, width, height);
+            viewport_width = width;
+            viewport_height = height;
+        }
         glClearColor(1.f * 57 / 255, 1.f * 57 / 255, 1.f * 57 / 255, 0.5f);
         //glClearColor(0.f, 0.f, 0.f, 0.f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glPolygonMode(GL_FRONT_AND_BACK, settings.PolygonMode);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, woodTexture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, eyeTexture);
-
-        // time stuff
+        {
+            GpuZone zone(gpuTimer, "clear");
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+        // resources finished by the upload thread become usable from here
+        if (uploads.collect() > 0) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray.id);
+            // completion callbacks bind whatever they build
+            stateCache.invalidate();
+        }
+
+        // latest simulation state, blended between its last two steps
+        sim->packets.acquire();
+        const FramePacket &packet = sim->packets.front();
         double time = glfwGetTime();
-        loop_deltatime = time - timestamp;
-        timestamp = time;
-
-        // calculating MVP
-        global_view = fps_camera.view();
-        global_proj = perspective(radians(45.f), SCR_WIDTH * 1.f / SCR_HEIGHT, 0.1f, 100.f);
-        //mat4 projection = perspective(radians(45.f), SCR_WIDTH * 1.f / SCR_HEIGHT, 0.1f, 100.f);
-        float R = 10;
-        vec3 cam_pos(cos(time) * R, 0, sin(time) * R);
-        look_at_camera.translate(vec3(cam_pos.x, cam_pos.y, cam_pos.z) * loop_deltatime);
-        //mat4 view = look_at_camera.view();
-        //mat4 view = arcball_camera.view();
-
-        // draw origin planes
-        planeShader.use();
-        mat4 model(1.0f);
-        glUniformMatrix4fv(planeModelUniform, 1, GL_FALSE, value_ptr(model));
-        glUniformMatrix4fv(planeViewUniform, 1, GL_FALSE, value_ptr(global_view));
-        glUniformMatrix4fv(planeProjUniform, 1, GL_FALSE, value_ptr(global_proj));
-        glBindVertexArray(planeVAO);
-        //glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        model = rotate(model, radians(90.f), vec3(1, 0, 0));
-        glUniformMatrix4fv(planeModelUniform, 1, GL_FALSE, value_ptr(model));
-        //glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        model = rotate(model, radians(90.f), vec3(0, 1, 0));
-        glUniformMatrix4fv(planeModelUniform, 1, GL_FALSE, value_ptr(model));
-        //glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-        // scattered cubes
-        vec3 cubePositions[] = {
-                vec3(2.0f, 5.0f, -15.0f),
-                vec3(-1.5f, -2.2f, -2.5f),
-                vec3(-3.8f, -2.0f, -12.3f),
-                vec3(2.4f, -0.4f, -3.5f),
-                vec3(-1.7f, 3.0f, -7.5f),
-                vec3(1.3f, -2.0f, -2.5f),
-                vec3(1.5f, 2.0f, -2.5f),
-                vec3(1.5f, 0.2f, -1.5f),
-                vec3(-1.3f, 1.0f, -1.5f)
-        };
-        pointsShader.use();
-        glUniformMatrix4fv(pointsViewUniform, 1, GL_FALSE, value_ptr(global_view));
-        glUniformMatrix4fv(pointsProjUniform, 1, GL_FALSE, value_ptr(global_proj));
-        cubeShader.use();
-        glUniformMatrix4fv(cubeViewUniform, 1, GL_FALSE, value_ptr(global_view));
-        glUniformMatrix4fv(cubeProjUniform, 1, GL_FALSE, value_ptr(global_proj));
-        glBindVertexArray(cubeVAO);
-        for (unsigned int i = 0; i < sizeof(cubePositions) / sizeof(vec3); i++) {
-            float angle = 20.0f * i;
-            mat4 _model(1.f);
-            _model = translate(_model, cubePositions[i]);
-            _model = rotate(_model, radians(angle), vec3(1.0f, 0.3f, 0.5f));
-            cubeShader.use();
-            glUniformMatrix4fv(cubeModelUniform, 1, GL_FALSE, value_ptr(_model));
-            //glDrawArrays(GL_TRIANGLE_STRIP, 0, 24);
-            if (settings.drawPoints) {
-                pointsShader.use();
-                glUniformMatrix4fv(pointsModelUniform, 1, GL_FALSE, value_ptr(_model));
-                //glDrawArrays(GL_POINTS, 0, 24);
+        float alpha = packet.alpha(time);
+        const mat4 spin_model = packet.spin_model(alpha);
+
+        // cube field, layers resolved here since uploads finish on this thread
+        int cubeCount;
+        {
+            TRACE_ZONE("pack cubes");
+            cubes.clear();
+            for (const CubeState &cube : packet.cubes) {
+                const Material &material = materials[cube.material];
+                cubes.push_back(CubeInstance{cube.spinning ? spin_model : cube.model, vec2(material.base->index(), material.overlay->index())});
             }
+            cubeCount = (int) cubes.size();
+            glBindBuffer(GL_ARRAY_BUFFER, cubeInstanceVBO);
+            glBufferData(GL_ARRAY_BUFFER, cubeCount * sizeof(CubeInstance), cubes.data(), GL_STREAM_DRAW);
+            GpuMemory::buffer(cubeInstanceVBO, cubeCount * sizeof(CubeInstance), GL_STREAM_DRAW, "cube instances");
+            Counters::add(Counters::BUFFER_BYTES, cubeCount * sizeof(CubeInstance));
         }
 
-        // rotating cube
-        cubeShader.use();
-        model = mat4(1);
-        static quat q = angleAxis((float) time, normalize(vec3(1, 0, 0)));
-        quat p = angleAxis(0.1f, normalize(vec3(1, 1, 0)));
-        q *= p;
-        model = toMat4(q) * model;
-        glUniformMatrix4fv(cubeModelUniform, 1, GL_FALSE, value_ptr(model));
-        //glDrawArrays(GL_TRIANGLE_STRIP, 0, 24);
-
-        //hexagons
-        hexShader.use();
-        glUniformMatrix4fv(hexView, 1, GL_FALSE, value_ptr(global_view));
-        glUniformMatrix4fv(hexProj, 1, GL_FALSE, value_ptr(global_proj));
-        hexAnim->draw(hexShader);
+        // hex tiles, one list per chunk
+        const std::vector<mat4> &hexTiles = packet.hex_tiles;
+        Counters::set(Counters::HEX_TILES, hexTiles.size());
+        hexCommands.record(jobs, hexTiles.size(), HEX_TILES_PER_LIST,
+                           [&hexTiles](CommandList &list, size_t first, size_t last) {
+                               hexAnim->record(list, hexTiles, first, last);
+                           });
+
+        // Late latch: everything above ran first, so the camera sampled
+        // here is as fresh as possible when the draws below are issued.
+        CameraSnapshot camera = cameraInput->snapshot.load();
+        const mat4 global_view = FPSCamera::view(camera.fps);
+        const mat4 global_proj = perspective(radians(45.f), width * 1.f / std::max(height, 1), 0.1f, 100.f);
+        cameraBuffer.write(CameraBlock{global_view, global_proj});
+
+        {
+            TRACE_ZONE("record scene");
+            sceneCommands.clear();
+            sceneCommands.polygon_mode(settings.PolygonMode);
+            // origin planes
+            if (settings.drawScene && planeVAO) {
+                sceneCommands.use_program(planeShader.ID);
+                sceneCommands.bind_vertex_array(planeVAO);
+                sceneCommands.uniform(planeLayersUniform, vec2(materials[0].base->index(), materials[0].overlay->index()));
+                mat4 model(1.0f);
+                sceneCommands.uniform(planeModelUniform, model);
+                sceneCommands.draw_elements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                model = rotate(model, radians(90.f), vec3(1, 0, 0));
+                sceneCommands.uniform(planeModelUniform, model);
+                sceneCommands.draw_elements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                model = rotate(model, radians(90.f), vec3(0, 1, 0));
+                sceneCommands.uniform(planeModelUniform, model);
+                sceneCommands.draw_elements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            }
+            // one instanced batch, the points pass reuses the same instances
+            if (settings.drawScene && cubeVAO) {
+                sceneCommands.bind_vertex_array(cubeVAO);
+                sceneCommands.use_program(cubeShader.ID);
+                sceneCommands.draw_arrays(GL_TRIANGLE_STRIP, 0, 24, cubeCount);
+                if (settings.drawPoints) {
+                    sceneCommands.use_program(pointsShader.ID);
+                    sceneCommands.draw_arrays(GL_POINTS, 0, 24, cubeCount);
+                }
+            }
+            // hexagons
+            sceneCommands.use_program(hexShader.ID);
+            sceneCommands.uniform(hexView, global_view);
+            sceneCommands.uniform(hexProj, global_proj);
+        }
+
+        {
+            GpuZone zone(gpuTimer, "scene pass");
+            sceneCommands.execute(stateCache);
+        }
+        cameraBuffer.fence();
+        {
+            GpuZone zone(gpuTimer, "hex pass");
+            hexCommands.execute(stateCache);
+        }
+
+        if (settings.reloadShaders.exchange(false)) {
+            // Programs are built across slices, as many per slice as fit
+            // before the deadline, and swapped in together in the last one
+            // with their uniforms and bindings, so no frame draws with a
+            // deleted program or a stale location.
+            struct Reload {
+                size_t next = 0;
+                unsigned int programs[sizeof(shaders) / sizeof(shaders[0])] = {};
+            };
+            std::shared_ptr<Reload> reload = std::make_shared<Reload>();
+            scheduler.submit(FrameScheduler::LOW, "shader reload", [&, reload](double deadline) {
+                const size_t count = sizeof(shaders) / sizeof(shaders[0]);
+                // at least one per call, a forced slice has no time left
+                do {
+                    reload->programs[reload->next] = shaders[reload->next]->rebuild();
+                    reload->next++;
+                } while (reload->next < count && glfwGetTime() < deadline);
+                if (reload->next < count)
+                    return false;
+                for (size_t i = 0; i < count; i++) {
+                    if (reload->programs[i])
+                        shaders[i]->replace(reload->programs[i]);
+                    else
+                        LOG_WARNING("shader %zu failed to build, keeping the old one", i);
+                }
+                configure();
+                stateCache.invalidate();
+                return true;
+            });
+        }
+        if (hexAnim->tileVAO && packet.params.hex_radius > 0 && packet.params.hex_radius != hexRadius) {
+            hexRadius = packet.params.hex_radius;
+            float radius = hexRadius;
+            // one outline of a few vertices: a single slice, not worth splitting
+            scheduler.submit(FrameScheduler::NORMAL, "hex mesh", [radius](double) {
+                hexAnim->rebuild_mesh(radius);
+                return true;
+            });
+        }
+        if (overlayInput.visible) {
+            if (tuned && packet.frame > tunedFrame)
+                tuned = false;
+            SceneParams params = tuned ? tunedParams : packet.params;
+            OverlayToggles toggles{settings.drawScene, settings.drawPoints};
+            if (overlay.build(overlayInput, gpuTimer, allocs, params, toggles)) {
+                sim->tune(params);
+                if (toggles.draw_scene != settings.drawScene)
+                    sim->set_spin_visible(toggles.draw_scene);
+                settings.drawScene = toggles.draw_scene;
+                settings.drawPoints = toggles.draw_points;
+                tunedParams = params;
+                tunedFrame = packet.frame;
+                tuned = true;
+                keyEvents++;
+                redraw.request();
+            }
+            GpuZone zone(gpuTimer, "overlay");
+            overlay.render(stateCache, width, height);
+        }
+        scheduler.run(frameStart + frameBudget);
+        gpuTimer.end(gpuFrame);
+        gpuTimer.end_frame();
 
         frames_cnt++;
         if (time - last_fps_time >= 1.0) {
-            printf("%f ms/frame\n", 1000.0 / double(frames_cnt));
+            LOG_INFO("%f ms/frame", 1000.0 / double(frames_cnt));
+            Counters::print(frames_cnt);
             frames_cnt = 0;
             last_fps_time += 1.0;
-            cout << hexAnim->pieces_drawn << endl;
+            latency.print();
+            latency.reset();
+            LOG_INFO("camera buffer waits: %.3f ms", 1000 * cameraBuffer.take_wait_time());
+            pacer.print();
+            pacer.reset();
+            uploads.print(1.0);
+            scheduler.print();
+            gpuTimer.print();
+            allocs.print();
+            GpuMemory::print();
+            LOG_INFO("commands: %zu scene + %zu hex (%.1f KB)", sceneCommands.commands(), hexCommands.commands(),
+                   (sceneCommands.bytes() + hexCommands.bytes()) / 1024.0);
+        }
+        {
+            TRACE_ZONE("swap buffers");
+            glfwSwapBuffers(window);
+        }
+        pacer.end_frame();
+        if (GLCapture::recording()) {
+            GLCapture::end_frame();
+            if (GLCapture::frames() >= options.capture_frames)
+                GLCapture::stop();
+        }
+        if (StartupProfiler::recording()) {
+            startup.step("first frame");
+            StartupProfiler::first_frame(options.startup_json);
+            GpuMemory::print(true);
+            if (options.exit_after_first_frame) {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+                // the event thread may be asleep in --on-demand
+                glfwPostEmptyEvent();
+            }
+        }
+        Counters::end_frame(1000 * (frameStart - lastFrameStart));
+        lastFrameStart = frameStart;
+        if (countersCsv)
+            Counters::write_csv_row(countersCsv);
+        if (metrics.running()) {
+            metricsSnapshot.update(glfwGetTime(), gpuTimer);
+            metrics.publish(metricsSnapshot);
+        }
+        // uploads in flight and deferred work need more frames to finish
+        if (options.on_demand && (!uploads.idle() || scheduler.backlog() > 0))
+            redraw.request();
+        // Steady state: no key pressed for a while and nothing loading,
+        // deferred or being traced; such frames should not allocate.
+        unsigned seenKeyEvents = keyEvents;
+        if (seenKeyEvents != lastKeyEvents) {
+            lastKeyEvents = seenKeyEvents;
+            steadySince = frame;
+        }
+        allocs.end_frame(frame - steadySince > ALLOC_WARMUP_FRAMES && uploads.idle() && scheduler.backlog() == 0
+                         && !Trace::enabled());
+        // only frames that show new input count
+        if (camera.input_time != last_input_time) {
+            latency.record(glfwGetTime() - camera.input_time);
+            last_input_time = camera.input_time;
         }
-        process_input(window);
-        glfwSwapBuffers(window);
-        glfwPollEvents();
     }
-    glfwTerminate();
-    return 0;
-}
-
-static void load2DTexture(uint &id, const std::string &path, bool alpha) {
-    glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    int width, height, nrChannels;
-    if (alpha)
-        stbi_set_flip_vertically_on_load(true);
-    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-    if (data) {
-        alpha
-        ? glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data)
-        : glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    } else
-        std::cout << "Failed to load texture: " << path << std::endl;
-    stbi_image_free(data);
+    if (countersCsv)
+        fclose(countersCsv);
+    GLCapture::stop();
+    // completions of late uploads build the vertex arrays deleted below and
+    // mark layers of textureArray ready
+    textureLoader.wait();
+    uploads.drain();
+    GpuMemory::print(true);
+    hexAnim->release();
+    glDeleteVertexArrays(1, &planeVAO);
+    glDeleteVertexArrays(1, &cubeVAO);
+    GLuint buffers[] = {planeVBO, planeEBO, cubeVBO, cubeInstanceVBO};
+    glDeleteBuffers(4, buffers);
+    for (GLuint buffer : buffers)
+        GpuMemory::release_buffer(buffer);
 }
 
 static void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
     SCR_WIDTH = width;
     SCR_HEIGHT = height;
-    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
     // mouse coordinates now are not the same
+    cameraInput->resize(width, height);
+    redraw.request();
 }
 
 static void error_callback(int error, const char *description) {
-    fprintf(stderr, "Error: %s\n", description);
+    LOG_ERROR("GLFW: %s", description);
 }
 
 static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    keyEvents++;
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GLFW_TRUE);
     if (key == GLFW_KEY_L && action == GLFW_PRESS) {
@@ -358,70 +739,77 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
     }
     if (key == GLFW_KEY_P && action == GLFW_PRESS)
         settings.drawPoints = !settings.drawPoints;
-
-    bool condition = action == GLFW_PRESS || action == GLFW_REPEAT;
-    float dT = 0.01;
-    float d_start_time = 1;
-    if (key == GLFW_KEY_R && condition)
-        hexAnim->start_time -= d_start_time;
-    if (key == GLFW_KEY_F && condition)
-        hexAnim->start_time += d_start_time;
-    if (key == GLFW_KEY_T && condition)
-        hexAnim->T -= dT;
-    if (key == GLFW_KEY_G && condition)
-        hexAnim->T += dT;
-    float dR = 0.05;
-    if (key == GLFW_KEY_Y && condition)
-        hexAnim->R += dR;
-    if (key == GLFW_KEY_H && condition)
-        hexAnim->R -= dR;
-    if (key == GLFW_KEY_U && action == GLFW_PRESS)
-        hexAnim->DIV += 1;
-    if (key == GLFW_KEY_J && action == GLFW_PRESS)
-        hexAnim->DIV -= 1;
+    if (key == GLFW_KEY_O && action == GLFW_PRESS)
+        settings.drawScene = !settings.drawScene;
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+        settings.reloadShaders = true;
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+        settings.toggleTrace = true;
+    if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
+        bool visible = !overlayInput.visible;
+        overlayInput.visible = visible;
+        glfwSetInputMode(window, GLFW_CURSOR, visible ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED);
+        if (!visible)
+            cameraInput->recenter();
+    }
+    redraw.request();
+
+    // hexagon tuning keys belong to the simulation
+    Simulation *sim = simulation;
+    if (sim) {
+        if (key == GLFW_KEY_O && action == GLFW_PRESS)
+            sim->set_spin_visible(settings.drawScene);
+        sim->post(InputEvent{key, action, mods});
+    }
 }
 
-static void process_input(GLFWwindow *window) {
-    int trackable_keys[] = {
-            GLFW_KEY_W,
-            GLFW_KEY_A,
-            GLFW_KEY_S,
-            GLFW_KEY_D,
-            GLFW_KEY_Q,
-            GLFW_KEY_E,
-            GLFW_KEY_Z,
-            GLFW_KEY_C,
-            GLFW_KEY_SPACE,
-            GLFW_KEY_LEFT_SHIFT
-    };
-
-    for (int trackable_key : trackable_keys) {
-        if (glfwGetKey(window, trackable_key) == GLFW_PRESS)
-            fps_controller.processKey(trackable_key, loop_deltatime);
+// bit i set while TRACKABLE_KEYS[i] is down
+static unsigned held_keys(GLFWwindow *window) {
+    unsigned held = 0;
+    for (size_t i = 0; i < sizeof(TRACKABLE_KEYS) / sizeof(int); i++) {
+        if (glfwGetKey(window, TRACKABLE_KEYS[i]) == GLFW_PRESS)
+            held |= 1u << i;
     }
+    return held;
 }
 
+// while the overlay is shown it gets the mouse, not the cameras
 static void cursor_position_callback(GLFWwindow *window, double xpos, double ypos) {
-    static bool first_mouse = true;
-    if (first_mouse) {
-        first_mouse = false;
-        last_mouse_x = xpos;
-        last_mouse_y = ypos;
+    if (overlayInput.visible) {
+        // window coordinates to framebuffer pixels, which the overlay lays out in
+        int width, height;
+        glfwGetWindowSize(window, &width, &height);
+        overlayInput.mouse_move(xpos * SCR_WIDTH / std::max(width, 1), ypos * SCR_HEIGHT / std::max(height, 1));
+        redraw.request();
+        return;
     }
-    float dx = xpos - last_mouse_x;
-    float dy = ypos - last_mouse_y;
-    last_mouse_x = xpos;
-    last_mouse_y = ypos;
-    fps_controller.process_mouse(dx, dy);
-    arcball_controller.mouseMove(xpos, ypos);
+    cameraInput->mouse_move(xpos, ypos);
 }
 
 static void mouse_button_callback(GLFWwindow *window, int button, int action, int mods) {
-    double mx, my;
-    glfwGetCursorPos(window, &mx, &my);
-    arcball_controller.mouseButton(button, action, mods, mx, my);
+    if (overlayInput.visible) {
+        overlayInput.mouse_button(button, action == GLFW_PRESS);
+        redraw.request();
+        return;
+    }
+    cameraInput->mouse_button(button, action, mods);
 }
 
 static void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
-    arcball_controller.mouseScroll(xoffset, yoffset);
-}
\ No newline at end of file
+    if (overlayInput.visible) {
+        overlayInput.scroll(yoffset);
+        redraw.request();
+        return;
+    }
+    cameraInput->scroll(xoffset, yoffset);
+}
+
+static void wait_events(double timeout) {
+    TRACE_ZONE("wait events");
+    glfwWaitEventsTimeout(timeout);
+}
+
+// window exposed or closing: the picture has to be redrawn or torn down
+static void refresh_callback(GLFWwindow *window) {
+    redraw.request();
+}
@@ -0,0 +1,109 @@
+#ifndef CG_OPTIONS_H
+#define CG_OPTIONS_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "log/logger.h"
+
+// Command line switches. Benchmarks run instead of opening the window.
+struct Options {
+    bool bench_jobs = false;
+    bool bench_commands = false;
+    bool bench_log = false;
+    // frames the CPU may run ahead of the GPU
+    int frames_in_flight = 2;
+    // 0 off, 1 vsync, -1 adaptive vsync
+    int swap_interval = 1;
+    // frame limiter target, 0 for none
+    double target_fps = 0;
+    // frame time deferred tasks may fill up to, in ms; 0 follows --fps
+    // or 60 Hz
+    double frame_budget = 0;
+    // redraw only when something changed
+    bool on_demand = false;
+    // frames [trace_first, trace_last] are traced, none if trace_last < trace_first
+    long trace_first = 0;
+    long trace_last = -1;
+    // abort when a steady-state frame allocates (CG_TRACK_ALLOCS builds)
+    bool assert_no_alloc = false;
+    // per-frame counters and frame times written here as CSV
+    const char *counters_csv = nullptr;
+    // Unix socket serving live metrics in the Prometheus text format
+    const char *metrics_socket = nullptr;
+    // startup phases and assets written here as JSON after the first frame
+    const char *startup_json = nullptr;
+    // quit once the first frame is shown, for timing startup
+    bool exit_after_first_frame = false;
+    // GL calls of the first capture_frames frames, and all setup before them, recorded here for cgreplay
+    const char *capture_file = nullptr;
+    int capture_frames = 1;
+    // messages below this are dropped at run time
+    Logger::Level log_level = Logger::LEVEL_INFO;
+    // also written here, rotated as it grows
+    const char *log_file = nullptr;
+};
+
+inline bool parse_log_level(const char *name, Logger::Level &level) {
+    const char *names[] = {"debug", "info", "warning", "error"};
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            level = (Logger::Level) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool parse_options(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--bench-jobs") == 0) {
+            options.bench_jobs = true;
+        } else if (strcmp(argv[i], "--bench-log") == 0) {
+            options.bench_log = true;
+        } else if (strcmp(argv[i], "--bench-commands") == 0) {
+            options.bench_commands = true;
+        } else if (strcmp(argv[i], "--on-demand") == 0) {
+            options.on_demand = true;
+        } else if (strcmp(argv[i], "--exit-after-first-frame") == 0) {
+            options.exit_after_first_frame = true;
+        } else if (strcmp(argv[i], "--assert-no-alloc") == 0) {
+            options.assert_no_alloc = true;
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && has_value) {
+            options.frames_in_flight = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--swap-interval") == 0 && has_value) {
+            options.swap_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fps") == 0 && has_value) {
+            options.target_fps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--counters-csv") == 0 && has_value) {
+            options.counters_csv = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-socket") == 0 && has_value) {
+            options.metrics_socket = argv[++i];
+        } else if (strcmp(argv[i], "--startup-json") == 0 && has_value) {
+            options.startup_json = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && has_value) {
+            options.capture_file = argv[++i];
+        } else if (strcmp(argv[i], "--capture-frames") == 0 && has_value) {
+            options.capture_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-file") == 0 && has_value) {
+            options.log_file = argv[++i];
+        } else if (strcmp(argv[i], "--log-level") == 0 && has_value && parse_log_level(argv[i + 1], options.log_level)) {
+            i++;
+        } else if (strcmp(argv[i], "--frame-budget") == 0 && has_value) {
+            options.frame_budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--trace-frames") == 0 && has_value
+                   && sscanf(argv[i + 1], "%ld-%ld", &options.trace_first, &options.trace_last) == 2) {
+            i++;
+        } else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            std::cerr << "Usage: CG [--bench-jobs] [--bench-commands] [--bench-log] [--frames-in-flight N] [--swap-interval 0|1|-1] [--fps N] [--frame-budget MS] [--trace-frames FIRST-LAST] [--on-demand] [--assert-no-alloc] [--counters-csv FILE] [--metrics-socket PATH] [--startup-json FILE] [--exit-after-first-frame] [--capture FILE] [--capture-frames N] [--log-level debug|info|warning|error] [--log-file FILE]"
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif //CG_OPTIONS_H
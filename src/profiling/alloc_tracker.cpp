@@ -0,0 +1,273 @@
+#include "alloc_tracker.h"
+
+#ifdef CG_TRACK_ALLOCS
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+// Everything here is constant-initialized, so the hooks work for
+// allocations made before main() and during thread start-up.
+namespace {
+    struct Counters {
+        std::atomic<uint64_t> news;
+        std::atomic<uint64_t> new_bytes;
+        std::atomic<uint64_t> mallocs;
+        std::atomic<uint64_t> malloc_bytes;
+        std::atomic<uint64_t> frees;
+
+        AllocStats load() const {
+            AllocStats s;
+            s.news = news.load(std::memory_order_relaxed);
+            s.new_bytes = new_bytes.load(std::memory_order_relaxed);
+            s.mallocs = mallocs.load(std::memory_order_relaxed);
+            s.malloc_bytes = malloc_bytes.load(std::memory_order_relaxed);
+            s.frees = frees.load(std::memory_order_relaxed);
+            return s;
+        }
+    };
+
+    // threads past the last slot share it
+    const int MAX_THREADS = 128;
+    Counters thread_counters[MAX_THREADS + 1];
+    std::atomic<int> thread_count{0};
+    thread_local Counters *local_counters = nullptr;
+    thread_local int local_tag = -1;
+
+    Counters tag_counters[alloc_tracker::MAX_TAGS];
+    const char *tag_names[alloc_tracker::MAX_TAGS];
+    std::atomic<int> tags_used{0};
+    std::mutex tag_mutex;
+
+    Counters &local() {
+        if (!local_counters)
+            local_counters = &thread_counters[std::min(thread_count.fetch_add(1), MAX_THREADS)];
+        return *local_counters;
+    }
+
+    void add(Counters &c, bool cpp, size_t size) {
+        if (cpp) {
+            c.news.fetch_add(1, std::memory_order_relaxed);
+            c.new_bytes.fetch_add(size, std::memory_order_relaxed);
+        } else {
+            c.mallocs.fetch_add(1, std::memory_order_relaxed);
+            c.malloc_bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    void count(bool cpp, size_t size) {
+        add(local(), cpp, size);
+        if (local_tag >= 0)
+            add(tag_counters[local_tag], cpp, size);
+    }
+
+    void count_free(void *ptr) {
+        if (ptr)
+            local().frees.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+#ifdef __GLIBC__
+// glibc's own entry points, so operator new is not counted twice and the
+// malloc replacements below have something to forward to
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static void *raw_malloc(size_t size) {
+    return __libc_malloc(size);
+}
+
+static void raw_free(void *ptr) {
+    __libc_free(ptr);
+}
+
+extern "C" {
+void *malloc(size_t size) {
+    count(false, size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count_, size_t size) {
+    count(false, count_ * size);
+    return __libc_calloc(count_, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (size)
+        count(false, size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+}
+#else
+
+static void *raw_malloc(size_t size) {
+    return std::malloc(size);
+}
+
+static void raw_free(void *ptr) {
+    std::free(ptr);
+}
+
+#endif
+
+static void *tracked_new(size_t size) {
+    count(true, size);
+    void *ptr = raw_malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+static void *tracked_new(size_t size, const std::nothrow_t &) noexcept {
+    count(true, size);
+    return raw_malloc(size ? size : 1);
+}
+
+static void tracked_delete(void *ptr) noexcept {
+    count_free(ptr);
+    raw_free(ptr);
+}
+
+void *operator new(size_t size) {
+    return tracked_new(size);
+}
+
+void *operator new[](size_t size) {
+    return tracked_new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &tag) noexcept {
+    return tracked_new(size, tag);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+    return tracked_new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept {
+    tracked_delete(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    tracked_delete(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    tracked_delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    tracked_delete(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    tracked_delete(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    tracked_delete(ptr);
+}
+
+namespace alloc_tracker {
+    bool enabled() {
+        return true;
+    }
+
+    AllocStats thread_totals() {
+        return local().load();
+    }
+
+    AllocStats totals() {
+        AllocStats sum;
+        int used = std::min(thread_count.load(), MAX_THREADS + 1);
+        for (int i = 0; i < used; i++) {
+            AllocStats s = thread_counters[i].load();
+            sum.news += s.news;
+            sum.new_bytes += s.new_bytes;
+            sum.mallocs += s.mallocs;
+            sum.malloc_bytes += s.malloc_bytes;
+            sum.frees += s.frees;
+        }
+        return sum;
+    }
+
+    int tag(const char *name) {
+        std::lock_guard<std::mutex> lock(tag_mutex);
+        int used = tags_used.load(std::memory_order_relaxed);
+        for (int i = 0; i < used; i++)
+            if (strcmp(tag_names[i], name) == 0)
+                return i;
+        if (used == MAX_TAGS)
+            return -1;
+        tag_names[used] = name;
+        tags_used.store(used + 1, std::memory_order_release);
+        return used;
+    }
+
+    int tag_count() {
+        return tags_used.load(std::memory_order_acquire);
+    }
+
+    const char *tag_name(int index) {
+        return tag_names[index];
+    }
+
+    AllocStats tag_totals(int index) {
+        return tag_counters[index].load();
+    }
+
+    int set_tag(int index) {
+        int previous = local_tag;
+        local_tag = index;
+        return previous;
+    }
+}
+
+#else
+
+namespace alloc_tracker {
+    bool enabled() {
+        return false;
+    }
+
+    AllocStats thread_totals() {
+        return AllocStats();
+    }
+
+    AllocStats totals() {
+        return AllocStats();
+    }
+
+    int tag(const char *name) {
+        return -1;
+    }
+
+    int tag_count() {
+        return 0;
+    }
+
+    const char *tag_name(int index) {
+        return "";
+    }
+
+    AllocStats tag_totals(int index) {
+        return AllocStats();
+    }
+
+    int set_tag(int index) {
+        return -1;
+    }
+}
+
+#endif
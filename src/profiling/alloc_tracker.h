@@ -0,0 +1,161 @@
+#ifndef CG_ALLOC_TRACKER_H
+#define CG_ALLOC_TRACKER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include "../log/logger.h"
+
+// Heap allocation counters fed by replacements of the global operator
+// new/delete and, on glibc, malloc/calloc/realloc/free (alloc_tracker.cpp).
+// They only exist in builds with CG_TRACK_ALLOCS; everywhere else the
+// counters stay zero and ALLOC_TAG compiles out. C++ allocations and
+// malloc calls are kept apart: the second also sees what the GL driver
+// and GLFW allocate, which the code here cannot avoid.
+struct AllocStats {
+    uint64_t news = 0;
+    uint64_t new_bytes = 0;
+    uint64_t mallocs = 0;
+    uint64_t malloc_bytes = 0;
+    uint64_t frees = 0;
+
+    AllocStats operator-(const AllocStats &o) const {
+        AllocStats d;
+        d.news = news - o.news;
+        d.new_bytes = new_bytes - o.new_bytes;
+        d.mallocs = mallocs - o.mallocs;
+        d.malloc_bytes = malloc_bytes - o.malloc_bytes;
+        d.frees = frees - o.frees;
+        return d;
+    }
+};
+
+namespace alloc_tracker {
+    const int MAX_TAGS = 32;
+
+    // true when the hooks are compiled in
+    bool enabled();
+
+    // calling thread since it started
+    AllocStats thread_totals();
+
+    // every thread since startup
+    AllocStats totals();
+
+    // Index of a call-site tag; allocations made inside an AllocTag scope
+    // are also counted under it. -1 once the table is full.
+    int tag(const char *name);
+
+    int tag_count();
+
+    const char *tag_name(int index);
+
+    AllocStats tag_totals(int index);
+
+    // tag the calling thread counts under, returns the previous one
+    int set_tag(int index);
+}
+
+// Counts allocations of its scope under a tag, on the calling thread.
+class AllocTag {
+public:
+    explicit AllocTag(int index) : previous(alloc_tracker::set_tag(index)) {}
+
+    ~AllocTag() {
+        alloc_tracker::set_tag(previous);
+    }
+
+    AllocTag(const AllocTag &) = delete;
+
+    AllocTag &operator=(const AllocTag &) = delete;
+
+private:
+    int previous;
+};
+
+#ifdef CG_TRACK_ALLOCS
+#define ALLOC_TAG_CONCAT_(a, b) a##b
+#define ALLOC_TAG_CONCAT(a, b) ALLOC_TAG_CONCAT_(a, b)
+#define ALLOC_TAG(name) \
+    static const int ALLOC_TAG_CONCAT(alloc_tag_index_, __LINE__) = alloc_tracker::tag(name); \
+    AllocTag ALLOC_TAG_CONCAT(alloc_tag_, __LINE__)(ALLOC_TAG_CONCAT(alloc_tag_index_, __LINE__))
+#else
+#define ALLOC_TAG(name) do {} while (0)
+#endif
+
+// Per-frame view of the counters for the render loop: allocations of the
+// render thread and of all threads, averaged per frame when printed. With
+// strict set, a steady-state frame (the caller decides which those are)
+// making any C++ allocation, on any thread, prints the tags involved and
+// aborts, so the debugger stops right after the culprit.
+class AllocMonitor {
+public:
+    explicit AllocMonitor(bool strict) : strict(strict) {
+        if (strict && !alloc_tracker::enabled())
+            LOG_WARNING("--assert-no-alloc needs a build with CG_TRACK_ALLOCS, not checking");
+    }
+
+    void begin_frame() {
+        frame_thread = alloc_tracker::thread_totals();
+        frame_all = alloc_tracker::totals();
+        if (strict) {
+            for (int i = 0; i < alloc_tracker::tag_count(); i++)
+                frame_tags[i] = alloc_tracker::tag_totals(i);
+        }
+    }
+
+    void end_frame(bool steady) {
+        AllocStats thread = alloc_tracker::thread_totals() - frame_thread;
+        AllocStats all = alloc_tracker::totals() - frame_all;
+        render.news += thread.news;
+        render.new_bytes += thread.new_bytes;
+        process.news += all.news;
+        process.new_bytes += all.new_bytes;
+        process.mallocs += all.mallocs;
+        process.malloc_bytes += all.malloc_bytes;
+        last = all;
+        frames++;
+        if (strict && steady && all.news > 0) {
+            LOG_ERROR("steady-state frame made %llu allocations (%llu bytes), %llu on the render thread",
+                   (unsigned long long) all.news, (unsigned long long) all.new_bytes,
+                   (unsigned long long) thread.news);
+            for (int i = 0; i < alloc_tracker::tag_count(); i++) {
+                AllocStats tag = alloc_tracker::tag_totals(i) - frame_tags[i];
+                if (tag.news > 0)
+                    LOG_ERROR("    %s: %llu allocations, %llu bytes", alloc_tracker::tag_name(i),
+                           (unsigned long long) tag.news, (unsigned long long) tag.new_bytes);
+            }
+            Logger::flush();
+            abort();
+        }
+    }
+
+    // all threads, the frame last ended
+    const AllocStats &last_frame() const {
+        return last;
+    }
+
+    // averages since the last call
+    void print() {
+        if (alloc_tracker::enabled() && frames > 0)
+            LOG_INFO("allocations/frame: render %.1f (%.0f B), all threads %.1f (%.0f B), malloc %.1f (%.0f B)",
+                   render.news / (double) frames, render.new_bytes / (double) frames,
+                   process.news / (double) frames, process.new_bytes / (double) frames,
+                   process.mallocs / (double) frames, process.malloc_bytes / (double) frames);
+        render = AllocStats();
+        process = AllocStats();
+        frames = 0;
+    }
+
+private:
+    bool strict;
+    AllocStats frame_thread;
+    AllocStats frame_all;
+    AllocStats frame_tags[alloc_tracker::MAX_TAGS];
+    AllocStats render;
+    AllocStats process;
+    AllocStats last;
+    int frames = 0;
+};
+
+#endif //CG_ALLOC_TRACKER_H
@@ -0,0 +1,176 @@
+#ifndef CG_COUNTERS_H
+#define CG_COUNTERS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include "../log/logger.h"
+
+// Registry of named per-frame counters and gauges. Counters are bumped from
+// any thread with add() and start from zero every frame; gauges hold the
+// last value set(). end_frame() on the render thread closes the frame: it
+// stores every value, with the frame time, in a ring of the last HISTORY
+// frames and resets the counters. The engine's own ids are fixed, so an
+// increment is one relaxed atomic add; more can be registered by name.
+class Counters {
+public:
+    static const int MAX_COUNTERS = 32;
+    static const int HISTORY = 300;
+
+    enum Id {
+        DRAW_CALLS,
+        INSTANCES,
+        TRIANGLES,
+        PROGRAM_BINDS,
+        VAO_BINDS,
+        TEXTURE_BINDS,
+        BINDS_SKIPPED,
+        UNIFORM_BYTES,
+        BUFFER_BYTES,
+        TEXTURE_BYTES,
+        HEX_TILES,
+        GPU_BYTES,
+        BUILTIN_COUNTERS
+    };
+
+    static void add(int id, int64_t amount = 1) {
+        state().values[id].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    static void set(int id, int64_t value) {
+        state().values[id].store(value, std::memory_order_relaxed);
+    }
+
+    // id of a new counter, or of the one already registered as name
+    static int register_counter(const char *name, bool gauge = false) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (int i = 0; i < s.count; i++)
+            if (strcmp(s.names[i], name) == 0)
+                return i;
+        if (s.count == MAX_COUNTERS)
+            return MAX_COUNTERS - 1;
+        s.names[s.count] = name;
+        s.gauges[s.count] = gauge;
+        return s.count++;
+    }
+
+    static int count() {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        return state().count;
+    }
+
+    static const char *name(int id) {
+        return state().names[id];
+    }
+
+    static bool gauge(int id) {
+        return state().gauges[id];
+    }
+
+    // render thread, once per frame
+    static void end_frame(double frame_ms) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        Frame &frame = s.history[s.frames % HISTORY];
+        frame.ms = frame_ms;
+        for (int i = 0; i < s.count; i++)
+            frame.values[i] = s.gauges[i] ? s.values[i].load(std::memory_order_relaxed)
+                                          : s.values[i].exchange(0, std::memory_order_relaxed);
+        s.frames++;
+    }
+
+    // frames closed so far
+    static uint64_t frames() {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        return state().frames;
+    }
+
+    // value of id in the frame closed back frames ago (0 = the last one)
+    static int64_t value(int id, int back = 0) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (back >= HISTORY || (uint64_t) back >= s.frames)
+            return 0;
+        return s.history[(s.frames - 1 - back) % HISTORY].values[id];
+    }
+
+    // frame time of the frame closed back frames ago
+    static double frame_ms(int back = 0) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (back >= HISTORY || (uint64_t) back >= s.frames)
+            return 0;
+        return s.history[(s.frames - 1 - back) % HISTORY].ms;
+    }
+
+    // mean of id over the last frames closed, at most HISTORY
+    static double average(int id, int frames) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        int n = (int) std::min<uint64_t>(std::min(frames, (int) HISTORY), s.frames);
+        double sum = 0;
+        for (int back = 0; back < n; back++)
+            sum += s.history[(s.frames - 1 - back) % HISTORY].values[id];
+        return n ? sum / n : 0;
+    }
+
+    // per-frame means over the last frames, one line
+    static void print(int frames) {
+        char line[1024];
+        int length = 0;
+        for (int i = 0, n = count(); i < n && length < (int) sizeof(line); i++)
+            length += snprintf(line + length, sizeof(line) - length, " %s %.0f%s", name(i), average(i, frames),
+                               i + 1 < n ? "," : "");
+        LOG_INFO("counters/frame:%s", length ? line : "");
+    }
+
+    static void write_csv_header(FILE *file) {
+        fprintf(file, "frame,frame_ms");
+        for (int i = 0, n = count(); i < n; i++)
+            fprintf(file, ",%s", name(i));
+        fprintf(file, "\n");
+    }
+
+    // the last closed frame
+    static void write_csv_row(FILE *file) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.frames == 0)
+            return;
+        const Frame &frame = s.history[(s.frames - 1) % HISTORY];
+        fprintf(file, "%llu,%.3f", (unsigned long long) (s.frames - 1), frame.ms);
+        for (int i = 0; i < s.count; i++)
+            fprintf(file, ",%lld", (long long) frame.values[i]);
+        fprintf(file, "\n");
+    }
+
+private:
+    struct Frame {
+        double ms;
+        int64_t values[MAX_COUNTERS];
+    };
+
+    struct State {
+        std::atomic<int64_t> values[MAX_COUNTERS]{};
+        const char *names[MAX_COUNTERS]{
+                "draw calls", "instances", "triangles", "program binds", "vao binds", "texture binds",
+                "binds skipped", "uniform bytes", "buffer bytes", "texture bytes", "hex tiles", "gpu bytes"};
+        bool gauges[MAX_COUNTERS]{false, false, false, false, false, false, false, false, false, false, true, true};
+        int count = BUILTIN_COUNTERS;
+        // guards registration and the history
+        std::mutex mutex;
+        Frame history[HISTORY]{};
+        uint64_t frames = 0;
+    };
+
+    static State &state() {
+        static State s;
+        return s;
+    }
+};
+
+#endif //CG_COUNTERS_H
@@ -0,0 +1,260 @@
+#ifndef CG_METRICS_SERVER_H
+#define CG_METRICS_SERVER_H
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "alloc_tracker.h"
+#include "counters.h"
+#include "trace.h"
+#include "../gl/gpu_timer.h"
+#include "../log/logger.h"
+#include "../threading/seqlock.h"
+
+// What the metrics server reports, published by the render thread once per
+// frame. Names point at string literals (counter and zone names), so they
+// stay valid on the server thread.
+struct MetricsSnapshot {
+    static const int FRAMES = 300;
+
+    uint64_t frames = 0;
+    double uptime = 0;
+    // the last min(frames, FRAMES) frame times, frame i at i % FRAMES
+    float frame_ms[FRAMES]{};
+    int counter_count = 0;
+    const char *counter_names[Counters::MAX_COUNTERS]{};
+    bool gauges[Counters::MAX_COUNTERS]{};
+    // gauges: current value; counters: the last frame and all frames so far
+    int64_t last_frame[Counters::MAX_COUNTERS]{};
+    int64_t totals[Counters::MAX_COUNTERS]{};
+    int gpu_count = 0;
+    const char *gpu_names[GpuTimer::MAX_NAMES]{};
+    float gpu_ms[GpuTimer::MAX_NAMES]{};
+    AllocStats allocs;
+
+    // render thread, after Counters::end_frame()
+    void update(double now, const GpuTimer &gpu) {
+        frame_ms[frames % FRAMES] = (float) Counters::frame_ms();
+        frames++;
+        uptime = now;
+        counter_count = Counters::count();
+        for (int i = 0; i < counter_count; i++) {
+            counter_names[i] = Counters::name(i);
+            gauges[i] = Counters::gauge(i);
+            last_frame[i] = Counters::value(i);
+            totals[i] = gauges[i] ? last_frame[i] : totals[i] + last_frame[i];
+        }
+        gpu_count = gpu.zone_count();
+        for (int i = 0; i < gpu_count; i++) {
+            gpu_names[i] = gpu.zone_name(i);
+            gpu_ms[i] = (float) gpu.average(i);
+        }
+        allocs = alloc_tracker::totals();
+    }
+};
+
+// Serves the latest MetricsSnapshot in the Prometheus text format on a
+// Unix domain socket, for watching unattended runs:
+//
+//     socat - UNIX-CONNECT:cg.sock
+//     curl --unix-socket cg.sock http://localhost/metrics
+//
+// Every connection gets one reply and is closed; a request starting with
+// GET is answered with an HTTP header first. The render thread only
+// stores into a seqlock, so a slow or stuck client never blocks it;
+// percentiles and formatting happen on the server thread.
+class MetricsServer {
+public:
+    ~MetricsServer() {
+        stop();
+    }
+
+    bool start(const char *socket_path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (strlen(socket_path) >= sizeof(address.sun_path)) {
+            LOG_ERROR("metrics: socket path too long: %s", socket_path);
+            return false;
+        }
+        strcpy(address.sun_path, socket_path);
+        // a socket file left over from an earlier run would make bind fail;
+        // anything else at the path is not ours to delete
+        struct stat existing;
+        if (lstat(socket_path, &existing) == 0) {
+            if (!S_ISSOCK(existing.st_mode)) {
+                LOG_ERROR("metrics: %s exists and is not a socket", socket_path);
+                return false;
+            }
+            unlink(socket_path);
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 4) < 0
+            || pipe(wake) < 0) {
+            LOG_ERROR("metrics: cannot listen on %s: %s", socket_path, strerror(errno));
+            if (listener >= 0)
+                close(listener);
+            listener = -1;
+            return false;
+        }
+        path = socket_path;
+        thread = std::thread([this] { run(); });
+        LOG_INFO("metrics: serving on %s", socket_path);
+        return true;
+    }
+
+    void stop() {
+        if (!thread.joinable())
+            return;
+        char byte = 0;
+        if (write(wake[1], &byte, 1) < 0)
+            LOG_WARNING("metrics: cannot wake the server thread");
+        thread.join();
+        close(listener);
+        close(wake[0]);
+        close(wake[1]);
+        struct stat existing;
+        if (lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+            unlink(path.c_str());
+        listener = -1;
+    }
+
+    bool running() const {
+        return listener >= 0;
+    }
+
+    // render thread, never waits
+    void publish(const MetricsSnapshot &snapshot) {
+        latest.store(snapshot);
+    }
+
+private:
+    SeqLock<MetricsSnapshot> latest;
+    int listener = -1;
+    int wake[2] = {-1, -1};
+    std::string path;
+    std::thread thread;
+    char reply[32 << 10];
+
+    void run() {
+        Trace::name_thread("metrics server");
+        while (true) {
+            pollfd fds[2] = {{listener, POLLIN, 0}, {wake[0], POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0 && errno != EINTR)
+                return;
+            if (fds[1].revents)
+                return;
+            if (!(fds[0].revents & POLLIN))
+                continue;
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            serve(client);
+            close(client);
+        }
+    }
+
+    void serve(int client) {
+        TRACE_ZONE("metrics request");
+        // a request, if the client sends one, shows up right away
+        char request[256];
+        pollfd fd{client, POLLIN, 0};
+        ssize_t received = poll(&fd, 1, 50) > 0 ? recv(client, request, sizeof(request) - 1, 0) : 0;
+        bool http = received >= 4 && memcmp(request, "GET ", 4) == 0;
+
+        MetricsSnapshot snapshot = latest.load();
+        size_t body = format(snapshot, reply, sizeof(reply));
+        if (http) {
+            char header[160];
+            int length = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\n\r\n", body);
+            send_all(client, header, length);
+        }
+        send_all(client, reply, body);
+    }
+
+    static void send_all(int client, const char *data, size_t size) {
+        while (size > 0) {
+            ssize_t sent = send(client, data, size, MSG_NOSIGNAL);
+            if (sent <= 0)
+                return;
+            data += sent;
+            size -= sent;
+        }
+    }
+
+    // resident set size from /proc, 0 where there is none
+    static uint64_t resident_bytes() {
+        FILE *file = fopen("/proc/self/statm", "r");
+        if (!file)
+            return 0;
+        unsigned long long pages = 0, resident = 0;
+        int read = fscanf(file, "%llu %llu", &pages, &resident);
+        fclose(file);
+        return read == 2 ? resident * (uint64_t) sysconf(_SC_PAGESIZE) : 0;
+    }
+
+    static size_t format(const MetricsSnapshot &s, char *out, size_t capacity) {
+        size_t length = 0;
+        auto print = [&](const char *format, auto... args) {
+            if (length < capacity)
+                length += std::max(0, snprintf(out + length, capacity - length, format, args...));
+        };
+        print("# HELP cg_uptime_seconds Seconds since the window opened.\n# TYPE cg_uptime_seconds gauge\n");
+        print("cg_uptime_seconds %.3f\n", s.uptime);
+        print("# TYPE cg_frames_total counter\ncg_frames_total %llu\n", (unsigned long long) s.frames);
+
+        int n = (int) std::min<uint64_t>(s.frames, MetricsSnapshot::FRAMES);
+        float sorted[MetricsSnapshot::FRAMES];
+        std::copy(s.frame_ms, s.frame_ms + n, sorted);
+        std::sort(sorted, sorted + n);
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+            sum += sorted[i];
+        print("# HELP cg_frame_time_ms Frame times over the last %d frames.\n# TYPE cg_frame_time_ms summary\n",
+              MetricsSnapshot::FRAMES);
+        const double quantiles[] = {0.5, 0.9, 0.99, 1};
+        for (double q : quantiles)
+            print("cg_frame_time_ms{quantile=\"%g\"} %.3f\n", q,
+                  n ? sorted[std::min(n - 1, (int) (q * n))] : 0.0f);
+        print("cg_frame_time_ms_sum %.3f\ncg_frame_time_ms_count %d\n", sum, n);
+
+        print("# HELP cg_counter_total Engine counters summed over all frames.\n# TYPE cg_counter_total counter\n");
+        for (int i = 0; i < s.counter_count; i++)
+            if (!s.gauges[i])
+                print("cg_counter_total{name=\"%s\"} %lld\n", s.counter_names[i], (long long) s.totals[i]);
+        print("# HELP cg_counter_last_frame Engine counters of the last frame, and gauges.\n"
+              "# TYPE cg_counter_last_frame gauge\n");
+        for (int i = 0; i < s.counter_count; i++)
+            print("cg_counter_last_frame{name=\"%s\"} %lld\n", s.counter_names[i], (long long) s.last_frame[i]);
+
+        print("# HELP cg_gpu_pass_ms GPU time per pass, mean of the last %d frames measured.\n"
+              "# TYPE cg_gpu_pass_ms gauge\n", GpuTimer::WINDOW);
+        for (int i = 0; i < s.gpu_count; i++)
+            print("cg_gpu_pass_ms{pass=\"%s\"} %.4f\n", s.gpu_names[i], s.gpu_ms[i]);
+
+        print("# HELP cg_resident_bytes Resident set size.\n# TYPE cg_resident_bytes gauge\n");
+        print("cg_resident_bytes %llu\n", (unsigned long long) resident_bytes());
+        if (alloc_tracker::enabled()) {
+            print("# TYPE cg_allocations_total counter\n");
+            print("cg_allocations_total{kind=\"new\"} %llu\n", (unsigned long long) s.allocs.news);
+            print("cg_allocations_total{kind=\"malloc\"} %llu\n", (unsigned long long) s.allocs.mallocs);
+            print("cg_allocations_total{kind=\"free\"} %llu\n", (unsigned long long) s.allocs.frees);
+            print("# TYPE cg_allocated_bytes_total counter\n");
+            print("cg_allocated_bytes_total{kind=\"new\"} %llu\n", (unsigned long long) s.allocs.new_bytes);
+            print("cg_allocated_bytes_total{kind=\"malloc\"} %llu\n", (unsigned long long) s.allocs.malloc_bytes);
+        }
+        return std::min(length, capacity);
+    }
+};
+
+#endif //CG_METRICS_SERVER_H
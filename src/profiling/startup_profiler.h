@@ -0,0 +1,201 @@
+#ifndef CG_STARTUP_PROFILER_H
+#define CG_STARTUP_PROFILER_H
+
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include "trace.h"
+#include "../log/logger.h"
+
+// Where startup time goes, from process start to the first swap: phases
+// (window creation, GL loading, scene setup) and assets (shaders,
+// textures), from any thread. Times count from the start of main; the
+// time between exec and main comes from /proc and is only as precise as
+// the kernel's clock ticks (10 ms on most systems). Recording stops at
+// first_frame(), so shader reloads and later loads do not show up.
+class StartupProfiler {
+public:
+    static const int MAX_ENTRIES = 128;
+    static const int MAX_NAME = 64;
+
+    struct Entry {
+        char kind[16];
+        char name[MAX_NAME];
+        char thread[16];
+        // ns since main
+        int64_t begin;
+        int64_t end;
+    };
+
+    // first thing in main
+    static void start() {
+        State &s = state();
+        s.origin = std::chrono::steady_clock::now();
+        int64_t before_main = exec_to_main();
+        if (before_main > 0)
+            record("process", "exec to main", -before_main, 0);
+    }
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - state().origin).count();
+    }
+
+    static bool recording() {
+        return !state().finished.load(std::memory_order_acquire);
+    }
+
+    static void record(const char *kind, const char *name, int64_t begin, int64_t end) {
+        if (!recording())
+            return;
+        std::string thread = Trace::thread_name();
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.count == MAX_ENTRIES || s.finished.load(std::memory_order_relaxed))
+            return;
+        Entry &entry = s.entries[s.count++];
+        copy(entry.kind, kind, sizeof(entry.kind));
+        copy(entry.name, name, sizeof(entry.name));
+        copy(entry.thread, thread.empty() ? "?" : thread.c_str(), sizeof(entry.thread));
+        entry.begin = begin;
+        entry.end = end;
+    }
+
+    // Right after the first glfwSwapBuffers returns: stops recording,
+    // logs the table and writes it to json_path if set.
+    static void first_frame(const char *json_path) {
+        State &s = state();
+        s.first_frame = now();
+        s.finished.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::sort(s.entries, s.entries + s.count, [](const Entry &a, const Entry &b) {
+            return a.begin < b.begin;
+        });
+        print(s);
+        if (json_path)
+            write_json(s, json_path);
+    }
+
+private:
+    struct State {
+        std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        std::atomic<bool> finished{false};
+        std::mutex mutex;
+        Entry entries[MAX_ENTRIES];
+        int count = 0;
+        int64_t first_frame = 0;
+    };
+
+    static State &state() {
+        static State s;
+        return s;
+    }
+
+    static void copy(char *to, const char *from, size_t size) {
+        strncpy(to, from, size - 1);
+        to[size - 1] = 0;
+    }
+
+    // Field 22 of /proc/self/stat is the start time in clock ticks since
+    // boot, which CLOCK_BOOTTIME counts in too; 0 where either is missing.
+    static int64_t exec_to_main() {
+        FILE *file = fopen("/proc/self/stat", "r");
+        if (!file)
+            return 0;
+        char line[1024];
+        size_t size = fread(line, 1, sizeof(line) - 1, file);
+        fclose(file);
+        line[size] = 0;
+        // the command name in field 2 may contain spaces, skip past it
+        const char *p = strrchr(line, ')');
+        unsigned long long start_ticks = 0;
+        if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                         &start_ticks) != 1)
+            return 0;
+        timespec boot{};
+        if (clock_gettime(CLOCK_BOOTTIME, &boot) != 0)
+            return 0;
+        int64_t started = (int64_t) (start_ticks * 1000000000ull / sysconf(_SC_CLK_TCK));
+        return boot.tv_sec * 1000000000ll + boot.tv_nsec - started;
+    }
+
+    static void print(const State &s) {
+        LOG_INFO("startup: first frame after %.1f ms", s.first_frame / 1e6);
+        LOG_INFO("  start ms    took ms  thread      kind      name");
+        for (int i = 0; i < s.count; i++) {
+            const Entry &e = s.entries[i];
+            // only used by LOG_INFO, which CG_LOG_LEVEL may compile out
+            (void) e;
+            LOG_INFO("%9.2f %10.2f  %-10s  %-8s  %s", e.begin / 1e6, (e.end - e.begin) / 1e6, e.thread, e.kind,
+                     e.name);
+        }
+        if (s.count == MAX_ENTRIES)
+            LOG_WARNING("startup: more than %d entries, the rest were dropped", (int) MAX_ENTRIES);
+    }
+
+    // names are paths and fixed strings, nothing that needs escaping
+    static void write_json(const State &s, const char *path) {
+        FILE *file = fopen(path, "w");
+        if (!file) {
+            LOG_ERROR("startup: cannot write %s", path);
+            return;
+        }
+        fprintf(file, "{\n  \"first_frame_ms\": %.3f,\n  \"entries\": [", s.first_frame / 1e6);
+        for (int i = 0; i < s.count; i++) {
+            const Entry &e = s.entries[i];
+            fprintf(file, "%s\n    {\"kind\": \"%s\", \"name\": \"%s\", \"thread\": \"%s\", "
+                          "\"start_ms\": %.3f, \"duration_ms\": %.3f}",
+                    i ? "," : "", e.kind, e.name, e.thread, e.begin / 1e6, (e.end - e.begin) / 1e6);
+        }
+        fprintf(file, "\n  ]\n}\n");
+        fclose(file);
+    }
+};
+
+// Records its scope as one startup entry while startup is being profiled.
+// name must outlive the scope.
+class StartupPhase {
+public:
+    StartupPhase(const char *kind, const char *name) : kind(kind), name(name), begin(StartupProfiler::now()) {
+    }
+
+    ~StartupPhase() {
+        StartupProfiler::record(kind, name, begin, StartupProfiler::now());
+    }
+
+    StartupPhase(const StartupPhase &) = delete;
+
+    StartupPhase &operator=(const StartupPhase &) = delete;
+
+private:
+    const char *kind;
+    const char *name;
+    int64_t begin;
+};
+
+// Straight-line startup code of one thread cut into phases: each step()
+// ends the phase that began at the previous step, or at construction, so
+// nothing between them goes unaccounted for.
+class StartupSteps {
+public:
+    StartupSteps() : last(StartupProfiler::now()) {
+    }
+
+    void step(const char *name) {
+        int64_t now = StartupProfiler::now();
+        StartupProfiler::record("phase", name, last, now);
+        last = now;
+    }
+
+private:
+    int64_t last;
+};
+
+#endif //CG_STARTUP_PROFILER_H
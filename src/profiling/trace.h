@@ -0,0 +1,255 @@
+#ifndef CG_TRACE_H
+#define CG_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../log/logger.h"
+
+// Scoped timing zones written to per-thread buffers and dumped in the
+// Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+//
+//     void step() {
+//         TRACE_ZONE("simulation step");
+//         ...
+//     }
+//
+// While no capture runs a zone costs one relaxed atomic load. During a
+// capture each thread appends complete events to its own fixed buffer with
+// no locks; a thread only takes the registry lock once, on its first event.
+// Names must be string literals (or otherwise outlive the dump). Builds
+// without CG_TRACING compile the zones out entirely.
+class Trace {
+public:
+    // events per thread and capture; later ones are dropped and counted
+    static const size_t CAPACITY = 1 << 16;
+
+    static bool enabled() {
+        return state().enabled.load(std::memory_order_relaxed);
+    }
+
+    // nanoseconds since the first call
+    static uint64_t now() {
+        static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - origin).count();
+    }
+
+    struct Event {
+        const char *name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    // written by its thread only (or by one thread, for a track), read by the dump
+    struct Buffer {
+        // allocated with the thread's first event
+        std::unique_ptr<Event[]> events;
+        std::atomic<size_t> count{0};
+        std::atomic<size_t> dropped{0};
+        std::atomic<uint32_t> epoch{0};
+        std::string name;
+    };
+
+    static void record(const char *name, uint64_t begin, uint64_t end) {
+        record(local(), name, begin, end);
+    }
+
+    // A timeline of its own that is not a thread, e.g. the GPU's; events
+    // are recorded to it with record(track, ...) from one thread at a time.
+    static Buffer &add_track(const std::string &name) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.buffers.emplace_back(new Buffer());
+        s.buffers.back()->name = name;
+        return *s.buffers.back();
+    }
+
+    static void record(Buffer &buffer, const char *name, uint64_t begin, uint64_t end) {
+        // acquire: the dump of the previous capture is done with the buffer
+        uint32_t epoch = state().epoch.load(std::memory_order_acquire);
+        if (buffer.epoch.load(std::memory_order_relaxed) != epoch) {
+            // first event of a new capture: this thread's buffer starts over
+            if (!buffer.events)
+                buffer.events.reset(new Event[CAPACITY]);
+            buffer.dropped.store(0, std::memory_order_relaxed);
+            buffer.count.store(0, std::memory_order_relaxed);
+            buffer.epoch.store(epoch, std::memory_order_release);
+        }
+        size_t index = buffer.count.load(std::memory_order_relaxed);
+        if (index >= CAPACITY) {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[index] = Event{name, begin, end};
+        buffer.count.store(index + 1, std::memory_order_release);
+    }
+
+    // shown as the thread's track name; call once at thread start
+    static void name_thread(const std::string &name) {
+        Buffer &buffer = local();
+        std::lock_guard<std::mutex> lock(state().mutex);
+        buffer.name = name;
+    }
+
+    // empty until name_thread() was called on this thread
+    static std::string thread_name() {
+        Buffer &buffer = local();
+        std::lock_guard<std::mutex> lock(state().mutex);
+        return buffer.name;
+    }
+
+    // begins a capture; events of earlier ones are discarded
+    static void start() {
+        state().epoch.fetch_add(1, std::memory_order_release);
+        state().enabled.store(true, std::memory_order_release);
+    }
+
+    static void stop() {
+        state().enabled.store(false, std::memory_order_release);
+    }
+
+    // Writes the last capture to path. Call after stop(); zones still open
+    // then end after the dump and are left out.
+    static bool write_json(const char *path) {
+        FILE *file = fopen(path, "w");
+        if (!file) {
+            LOG_ERROR("cannot write trace %s", path);
+            return false;
+        }
+        State &s = state();
+        uint32_t epoch = s.epoch.load(std::memory_order_relaxed);
+        size_t written = 0, dropped = 0;
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (size_t tid = 0; tid < s.buffers.size(); tid++) {
+            const Buffer &buffer = *s.buffers[tid];
+            if (!buffer.name.empty()) {
+                fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%zu,"
+                              "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", tid, buffer.name.c_str());
+                first = false;
+            }
+            if (buffer.epoch.load(std::memory_order_acquire) != epoch)
+                continue;
+            size_t count = buffer.count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                const Event &event = buffer.events[i];
+                fprintf(file, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                        first ? "" : ",\n", event.name, tid, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+                first = false;
+            }
+            written += count;
+            dropped += buffer.dropped.load(std::memory_order_relaxed);
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        if (dropped)
+            LOG_WARNING("trace: %zu events written to %s, %zu dropped (buffers full)", written, path, dropped);
+        else
+            LOG_INFO("trace: %zu events written to %s", written, path);
+        return true;
+    }
+
+private:
+    struct State {
+        std::atomic<bool> enabled{false};
+        std::atomic<uint32_t> epoch{0};
+        std::mutex mutex;
+        // never freed, threads may exit before the dump
+        std::vector<std::unique_ptr<Buffer>> buffers;
+    };
+
+    static State &state() {
+        static State s;
+        return s;
+    }
+
+    static Buffer &local() {
+        thread_local Buffer *buffer = nullptr;
+        if (!buffer) {
+            State &s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.buffers.emplace_back(new Buffer());
+            buffer = s.buffers.back().get();
+        }
+        return *buffer;
+    }
+};
+
+// Times its scope if a capture is running when it opens.
+class TraceZone {
+public:
+    explicit TraceZone(const char *name) : name(name), active(Trace::enabled()), begin(active ? Trace::now() : 0) {}
+
+    ~TraceZone() {
+        if (active)
+            Trace::record(name, begin, Trace::now());
+    }
+
+    TraceZone(const TraceZone &) = delete;
+
+    TraceZone &operator=(const TraceZone &) = delete;
+
+private:
+    const char *name;
+    bool active;
+    uint64_t begin;
+};
+
+// Starts and stops captures for a frame range given on the command line,
+// or toggled by a hotkey; each capture goes to trace_<first frame>.json.
+class TraceCapture {
+public:
+    // frames [first, last] are captured, none if last < first
+    TraceCapture(long first, long last) : first(first), last(last) {}
+
+    // render thread, at the start of every frame
+    void begin_frame(long frame, bool toggle) {
+        if (toggle || (frame == first && first <= last))
+            capturing ? finish() : begin(frame);
+        else if (capturing && frame == last + 1 && started == first)
+            finish();
+    }
+
+    ~TraceCapture() {
+        if (capturing)
+            finish();
+    }
+
+private:
+    long first;
+    long last;
+    long started = -1;
+    bool capturing = false;
+
+    void begin(long frame) {
+        Trace::start();
+        started = frame;
+        capturing = true;
+        LOG_INFO("trace: capturing from frame %ld", frame);
+    }
+
+    void finish() {
+        Trace::stop();
+        capturing = false;
+        char path[64];
+        snprintf(path, sizeof(path), "trace_%ld.json", started);
+        Trace::write_json(path);
+    }
+};
+
+#ifdef CG_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#else
+#define TRACE_ZONE(name) do {} while (0)
+#endif
+
+#endif //CG_TRACE_H
@@ -0,0 +1,32 @@
+#ifndef CG_REDRAW_SIGNAL_H
+#define CG_REDRAW_SIGNAL_H
+
+#include <condition_variable>
+#include <mutex>
+
+// Dirty flag for on-demand rendering. Anything that changes what is on
+// screen calls request(); the render thread sleeps in wait() until then.
+class RedrawSignal {
+public:
+    void request() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            dirty = true;
+        }
+        cv.notify_one();
+    }
+
+    // blocks until a redraw was requested and clears the request
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return dirty; });
+        dirty = false;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool dirty = true;
+};
+
+#endif //CG_REDRAW_SIGNAL_H
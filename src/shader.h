@@ -4,9 +4,11 @@
 #include <glad/glad.h>
 
 #include <string>
-#include <fstream>
-#include <sstream>
-#include <iostream>
+#include "io/vfs.h"
+#include "profiling/trace.h"
+#include "profiling/alloc_tracker.h"
+#include "profiling/startup_profiler.h"
+#include "log/logger.h"
 
 const int MAX_INFO_LEN = 1024;
 
@@ -14,74 +16,98 @@ class Shader {
 public:
     unsigned int ID;
 
-    Shader(const char *vertexPath, const char *fragmentPath) {
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try {
-            // open files
-            system("pwd");
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-        }
-        catch (std::ifstream::failure e) {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+    // sources come from the VFS and are handed to GL in place, no copies
+    Shader(const char *vertexPath, const char *fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath) {
+        ID = build(vertexPath, fragmentPath);
+    }
+
+    // Builds the program again from the current sources. The old program
+    // is only replaced if the new one links, so a broken edit keeps the
+    // last good version running. Uniform locations must be looked up again.
+    bool reload() {
+        unsigned int program = rebuild();
+        if (!program)
+            return false;
+        replace(program);
+        return true;
+    }
+
+    // The two halves of reload(), for swapping several programs at once:
+    // rebuild() returns a new linked program, or 0 if it failed to link,
+    // and leaves ID alone; replace() then deletes the old program.
+    unsigned int rebuild() const {
+        unsigned int program = build(vertexPath.c_str(), fragmentPath.c_str());
+        int success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(program);
+            return 0;
         }
-        const char *vShaderCode = vertexCode.c_str();
-        const char *fShaderCode = fragmentCode.c_str();
+        return program;
+    }
+
+    void replace(unsigned int program) {
+        glDeleteProgram(ID);
+        ID = program;
+    }
+
+    void use() {
+        glUseProgram(ID);
+    }
+
+    // names are C strings; a std::string parameter made every call with a
+    // literal allocate
+    void setBool(const char *name, bool value) const {
+        glUniform1i(glGetUniformLocation(ID, name), (int) value);
+    }
+
+    void setInt(const char *name, int value) const {
+        glUniform1i(glGetUniformLocation(ID, name), value);
+    }
+
+    void setFloat(const char *name, float value) const {
+        glUniform1f(glGetUniformLocation(ID, name), value);
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+
+    static unsigned int build(const char *vertexPath, const char *fragmentPath) {
+        TRACE_ZONE("shader build");
+        ALLOC_TAG("shader build");
+        StartupPhase phase("shader", vertexPath);
+        FileView vertexCode = vfs().read(vertexPath);
+        FileView fragmentCode = vfs().read(fragmentPath);
+        if (!vertexCode || !fragmentCode)
+            LOG_ERROR("cannot read shader %s or %s", vertexPath, fragmentPath);
+        const char *vShaderCode = vertexCode.data ? (const char *) vertexCode.data : "";
+        const char *fShaderCode = fragmentCode.data ? (const char *) fragmentCode.data : "";
+        int vShaderLength = (int) vertexCode.size;
+        int fShaderLength = (int) fragmentCode.size;
         // compile shaders
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glShaderSource(vertex, 1, &vShaderCode, &vShaderLength);
         glCompileShader(vertex);
         checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glShaderSource(fragment, 1, &fShaderCode, &fShaderLength);
         glCompileShader(fragment);
         checkCompileErrors(fragment, "FRAGMENT");
         // program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        unsigned int program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glLinkProgram(program);
+        checkCompileErrors(program, "PROGRAM");
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        return program;
     }
 
-    void use() {
-        glUseProgram(ID);
-    }
-
-    void setBool(const std::string &name, bool value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int) value);
-    }
-
-    void setInt(const std::string &name, int value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-    }
-
-    void setFloat(const std::string &name, float value) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-    }
-
-private:
     static void checkCompileErrors(unsigned int shader, const std::string &type) {
         int success;
         char infoLog[MAX_INFO_LEN];
@@ -89,15 +115,13 @@ private:
             glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
             if (!success) {
                 glGetShaderInfoLog(shader, 1024, nullptr, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog;
-                std::cout << "\n ------------------------------------------------------- " << std::endl;
+                LOG_ERROR("%s shader failed to compile:\n%s", type.c_str(), infoLog);
             }
         } else {
             glGetProgramiv(shader, GL_LINK_STATUS, &success);
             if (!success) {
                 glGetProgramInfoLog(shader, 1024, nullptr, infoLog);
-                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog;
-                std::cout << "\n ------------------------------------------------------- " << std::endl;
+                LOG_ERROR("program failed to link:\n%s", infoLog);
             }
         }
     }
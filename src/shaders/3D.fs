@@ -1,14 +1,14 @@
 #version 330 core
 out vec4 FragColor;
 in vec2 TexCoord;
+flat in vec2 Layers;
 
-uniform sampler2D texSampler0;
-uniform sampler2D texSampler1;
+uniform sampler2DArray texArray;
 
 void main()
 {
-    vec4 x = texture(texSampler1, vec2(TexCoord.s, TexCoord.t));
-    FragColor = mix(texture(texSampler0, TexCoord),
+    vec4 x = texture(texArray, vec3(TexCoord, Layers.y));
+    FragColor = mix(texture(texArray, vec3(TexCoord, Layers.x)),
                     x,
                     x.a * 0.7);
 }
\ No newline at end of file
@@ -1,15 +1,20 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in mat4 aModel;
+layout (location = 6) in vec2 aLayers;
 
 out vec2 TexCoord;
+flat out vec2 Layers;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * aModel * vec4(aPos, 1.0);
     TexCoord = aTexCoord;
+    Layers = aLayers;
 }
\ No newline at end of file
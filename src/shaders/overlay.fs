@@ -0,0 +1,19 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 uv;
+in vec4 color;
+flat in vec4 clip;
+
+uniform sampler2D font;
+uniform vec2 screen;
+
+void main()
+{
+    // per-vertex clip rects stand in for scissor changes between draws
+    vec2 p = vec2(gl_FragCoord.x, screen.y - gl_FragCoord.y);
+    if (p.x < clip.x || p.y < clip.y || p.x > clip.x + clip.z || p.y > clip.y + clip.w)
+        discard;
+    FragColor = color * texture(font, uv);
+}
\ No newline at end of file
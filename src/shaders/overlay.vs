@@ -0,0 +1,21 @@
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aUV;
+layout (location = 2) in vec4 aColor;
+layout (location = 3) in vec4 aClip;
+
+// framebuffer size in pixels
+uniform vec2 screen;
+
+out vec2 uv;
+out vec4 color;
+// x, y, w, h from the top left, like the positions
+flat out vec4 clip;
+
+void main()
+{
+    uv = aUV;
+    color = aColor;
+    clip = aClip;
+    gl_Position = vec4(2 * aPos.x / screen.x - 1, 1 - 2 * aPos.y / screen.y, 0, 1);
+}
\ No newline at end of file
@@ -3,14 +3,14 @@ out vec4 FragColor;
 in  vec3 vertexColor;
 in vec2 TexCoord;
 
-uniform sampler2D texSampler0;
-uniform sampler2D texSampler1;
+uniform sampler2DArray texArray;
+uniform vec2 layers;
 
 void main()
 {
-    vec4 x = texture(texSampler1, vec2(TexCoord.s, TexCoord.t));
+    vec4 x = texture(texArray, vec3(TexCoord, layers.y));
     //FragColor = vec4(vertexColor, 1.0);
-    FragColor = mix(texture(texSampler0, TexCoord),
+    FragColor = mix(texture(texArray, vec3(TexCoord, layers.x)),
                     x,
                     x.a * 0.7) * vec4(vertexColor, 1.0);
 }
\ No newline at end of file
@@ -7,8 +7,10 @@ out vec3 vertexColor;
 out vec2 TexCoord;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+};
 
 void main()
 {
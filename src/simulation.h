@@ -0,0 +1,263 @@
+#ifndef CG_SIMULATION_H
+#define CG_SIMULATION_H
+
+#include <GLFW/glfw3.h>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include "camera/look_at_camera.h"
+#include "frame_packet.h"
+#include "redraw_signal.h"
+#include "hexagons.h"
+#include "threading/triple_buffer.h"
+#include "profiling/trace.h"
+#include "profiling/alloc_tracker.h"
+
+// Fixed simulation step; ticks run at this rate whatever the frame rate.
+const double SIMULATION_STEP = 1.0 / 120;
+// Ticks caught up in one go before the backlog is dropped (after a stall).
+const int MAX_CATCH_UP_STEPS = 8;
+// Rotating cube, radians per second about (1, 1, 0).
+const float SPIN_RATE = 6.f;
+
+// key callback arguments, replayed in order on the simulation thread
+struct InputEvent {
+    int key;
+    int action;
+    int mods;
+};
+
+// Owns the animations and advances them on its own thread in fixed steps,
+// publishing a FramePacket after each batch of steps. The key callback only
+// posts events, so no simulation state is shared with other threads.
+// Simulation cost is bounded by the tick rate, not the frame rate. The
+// user-driven cameras live in CameraInput on the event thread.
+class Simulation {
+public:
+    TripleBuffer<FramePacket> packets;
+    // woken after every publish when set
+    RedrawSignal *redraw = nullptr;
+    // stop stepping while nothing moves, until the next event
+    bool idle_when_settled = false;
+
+    explicit Simulation(HexagonAnimation *hexAnim) : hexAnim(hexAnim),
+                                                     look_at_camera(vec3(0, 0, 3), vec3(0, 0, 0), vec3(0, 1, 0)) {}
+
+    ~Simulation() {
+        stop();
+    }
+
+    void start() {
+        sim_time = glfwGetTime();
+        rotation = angleAxis((float) sim_time, normalize(vec3(1, 0, 0)));
+        previous_rotation = rotation;
+        thread = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // event thread
+    void post(const InputEvent &event) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back(event);
+        }
+        cv.notify_one();
+    }
+
+    // any thread; applied before the next step
+    void tune(const SceneParams &params) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tuning = params;
+            tuned = true;
+        }
+        cv.notify_one();
+    }
+
+    // the spinning cube only keeps the simulation busy while it is drawn
+    void set_spin_visible(bool visible) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            spin_visible = visible;
+        }
+        cv.notify_one();
+    }
+
+private:
+    HexagonAnimation *hexAnim;
+    LookAtCamera look_at_camera;
+    double sim_time = 0;
+    quat rotation;
+    quat previous_rotation;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<InputEvent> events;
+    std::vector<InputEvent> pending;
+    uint64_t ticks = 0;
+    bool stopping = false;
+    bool spin_visible = false;
+    SceneParams tuning;
+    bool tuned = false;
+    int stress_cubes = 0;
+
+    bool settled() const {
+        return !spin_visible && hexAnim->settled(sim_time);
+    }
+
+    void run() {
+        Trace::name_thread("simulation");
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (idle_when_settled && settled() && events.empty()) {
+                    // at rest: no steps until something happens, then resume
+                    // with a single step rather than a catch-up burst
+                    cv.wait(lock, [this] { return stopping || !events.empty() || tuned || !settled(); });
+                    sim_time = std::max(sim_time, glfwGetTime() - SIMULATION_STEP);
+                }
+                // sleep until the next step is due; stop() wakes us early
+                double wait = sim_time + SIMULATION_STEP - glfwGetTime();
+                if (wait > 0)
+                    cv.wait_for(lock, std::chrono::duration<double>(wait), [this] { return stopping; });
+                if (stopping)
+                    return;
+                pending.swap(events);
+                if (tuned) {
+                    apply_tuning(tuning);
+                    tuned = false;
+                }
+            }
+            for (const InputEvent &event : pending)
+                apply_key(event.key, event.action);
+            pending.clear();
+
+            // accumulator: sim_time trails the clock by less than one step
+            double now = glfwGetTime();
+            int steps = 0;
+            while (sim_time + SIMULATION_STEP <= now && steps < MAX_CATCH_UP_STEPS) {
+                previous_rotation = rotation;
+                sim_time += SIMULATION_STEP;
+                step(sim_time, (float) SIMULATION_STEP);
+                steps++;
+            }
+            if (sim_time + SIMULATION_STEP <= now)
+                sim_time = now;
+            if (steps == 0)
+                continue;
+            produce(packets.back());
+            packets.publish();
+            if (redraw)
+                redraw->request();
+        }
+    }
+
+    void step(double time, float dt) {
+        TRACE_ZONE("simulation step");
+        float R = 10;
+        vec3 cam_pos(cos(time) * R, 0, sin(time) * R);
+        look_at_camera.translate(vec3(cam_pos.x, cam_pos.y, cam_pos.z) * dt);
+
+        rotation *= angleAxis(SPIN_RATE * dt, normalize(vec3(1, 1, 0)));
+        ticks++;
+    }
+
+    // Built once per batch of steps. Hex tiles are taken at the latest
+    // step only; their layout changes discretely and is not interpolated.
+    void produce(FramePacket &packet) {
+        TRACE_ZONE("produce packet");
+        ALLOC_TAG("produce packet");
+        packet.frame = ticks;
+        packet.time = sim_time;
+        packet.step = SIMULATION_STEP;
+        packet.spin[0] = previous_rotation;
+        packet.spin[1] = rotation;
+
+        // scattered cubes
+        vec3 cubePositions[] = {
+                vec3(2.0f, 5.0f, -15.0f),
+                vec3(-1.5f, -2.2f, -2.5f),
+                vec3(-3.8f, -2.0f, -12.3f),
+                vec3(2.4f, -0.4f, -3.5f),
+                vec3(-1.7f, 3.0f, -7.5f),
+                vec3(1.3f, -2.0f, -2.5f),
+                vec3(1.5f, 2.0f, -2.5f),
+                vec3(1.5f, 0.2f, -1.5f),
+                vec3(-1.3f, 1.0f, -1.5f)
+        };
+        packet.cubes.clear();
+        for (unsigned int i = 0; i < sizeof(cubePositions) / sizeof(vec3); i++) {
+            float angle = 20.0f * i;
+            mat4 model(1.f);
+            model = translate(model, cubePositions[i]);
+            model = rotate(model, radians(angle), vec3(1.0f, 0.3f, 0.5f));
+            packet.cubes.push_back(CubeState{model, (int) i % 2, false});
+        }
+        // stress field: a cube of cubes behind the scene
+        int side = (int) std::ceil(std::cbrt((double) stress_cubes));
+        for (int i = 0; i < stress_cubes; i++) {
+            vec3 cell(i % side, i / side % side, i / (side * side));
+            mat4 model = translate(mat4(1.f), vec3(-side, -side, -2 * side - 20) + 2.f * cell);
+            packet.cubes.push_back(CubeState{model, i % 2, false});
+        }
+        // rotating cube
+        packet.cubes.push_back(CubeState{mat4(1.f), 0, true});
+
+        hexAnim->simulate(sim_time, packet.hex_tiles);
+        packet.params.hex_radius = hexAnim->R;
+        packet.params.hex_period = hexAnim->T;
+        packet.params.hex_divisions = hexAnim->DIV;
+        packet.params.hex_elapsed = (float) (sim_time - hexAnim->start_time);
+        packet.params.stress_cubes = stress_cubes;
+    }
+
+    void apply_tuning(const SceneParams &params) {
+        hexAnim->R = params.hex_radius;
+        hexAnim->T = params.hex_period;
+        hexAnim->DIV = params.hex_divisions;
+        hexAnim->start_time = sim_time - params.hex_elapsed;
+        stress_cubes = params.stress_cubes;
+    }
+
+    void apply_key(int key, int action) {
+        bool condition = action == GLFW_PRESS || action == GLFW_REPEAT;
+        float dT = 0.01;
+        float d_start_time = 1;
+        if (key == GLFW_KEY_R && condition)
+            hexAnim->start_time -= d_start_time;
+        if (key == GLFW_KEY_F && condition)
+            hexAnim->start_time += d_start_time;
+        if (key == GLFW_KEY_T && condition)
+            hexAnim->T -= dT;
+        if (key == GLFW_KEY_G && condition)
+            hexAnim->T += dT;
+        float dR = 0.05;
+        if (key == GLFW_KEY_Y && condition)
+            hexAnim->R += dR;
+        if (key == GLFW_KEY_H && condition)
+            hexAnim->R -= dR;
+        if (key == GLFW_KEY_U && action == GLFW_PRESS)
+            hexAnim->DIV += 1;
+        if (key == GLFW_KEY_J && action == GLFW_PRESS)
+            hexAnim->DIV -= 1;
+    }
+};
+
+#endif //CG_SIMULATION_H
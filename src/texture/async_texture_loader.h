@@ -0,0 +1,216 @@
+#ifndef CG_ASYNC_TEXTURE_LOADER_H
+#define CG_ASYNC_TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "texture_cooker.h"
+#include "texture_array.h"
+#include "../threading/job_system.h"
+#include "../gl/gpu_memory.h"
+#include "../gl/upload_thread.h"
+#include "../log/logger.h"
+#include "../profiling/startup_profiler.h"
+
+// Texture whose id points at a shared placeholder until its upload finishes.
+struct Texture {
+    GLuint id = 0;
+    int width = 0;
+    int height = 0;
+    bool ready = false;
+    std::string path;
+};
+
+// Loads cooked mip chains as jobs (decoding and cooking only when the cache
+// is stale) and hands them to the upload thread, which creates and fills
+// the textures in its own context. Targets are standalone 2D textures or
+// layers of a TextureArray. Textures and layers turn ready on the render
+// thread, in UploadThread::collect().
+class AsyncTextureLoader {
+public:
+    // uploads must outlive the workers of jobs
+    AsyncTextureLoader(JobSystem &jobs, UploadThread &uploads) : jobs(jobs),
+                                                                 uploads(uploads),
+                                                                 pending(std::make_shared<std::atomic<int>>(0)) {
+        unsigned char grey[4] = {128, 128, 128, 255};
+        glGenTextures(1, &placeholder);
+        glBindTexture(GL_TEXTURE_2D, placeholder);
+        allocate_storage(1, GL_RGBA8, 1, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        GpuMemory::texture(placeholder, GL_RGBA8, 1, 1, 1, 1, "placeholder");
+    }
+
+    // loads in flight finish first, their completions need the loader
+    ~AsyncTextureLoader() {
+        wait();
+        for (Texture &texture : textures) {
+            if (texture.ready) {
+                glDeleteTextures(1, &texture.id);
+                GpuMemory::release_texture(texture.id);
+            }
+        }
+        glDeleteTextures(1, &placeholder);
+        GpuMemory::release_texture(placeholder);
+    }
+
+    AsyncTextureLoader(const AsyncTextureLoader &) = delete;
+
+    AsyncTextureLoader &operator=(const AsyncTextureLoader &) = delete;
+
+    // Returns immediately; the texture samples the placeholder until ready.
+    const Texture *load(const std::string &path, bool alpha = false, bool flip = false) {
+        textures.emplace_back();
+        Texture *texture = &textures.back();
+        texture->id = placeholder;
+        texture->path = path;
+        submit(LoadJob{texture, nullptr, nullptr, CookedTexture()}, path, alpha, flip);
+        return texture;
+    }
+
+    // Resamples to the array's layer size if needed. The returned layer
+    // reports the placeholder index until ready; the array's placeholder is
+    // returned when it is full. Render thread.
+    const TextureLayer *load_layer(TextureArray &array, const std::string &path, bool alpha = false,
+                                   bool flip = false) {
+        TextureLayer *layer = array.reserve(path);
+        if (!layer) {
+            LOG_ERROR("texture array full, cannot load %s", path.c_str());
+            return array.placeholder();
+        }
+        // the array's storage was created in this context
+        uploads.barrier();
+        submit(LoadJob{nullptr, &array, layer, CookedTexture()}, path, alpha, flip);
+        return layer;
+    }
+
+    // Render thread: returns once every load has finished and its texture or
+    // layer is ready, or failed. Used at shutdown, while the arrays loaded
+    // into still exist.
+    void wait() {
+        // decode jobs may still be about to submit their uploads
+        while (*pending > 0) {
+            uploads.drain();
+            if (*pending > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // no decode or upload outstanding
+    bool idle() const {
+        return *pending == 0;
+    }
+
+    GLuint placeholder_id() const {
+        return placeholder;
+    }
+
+private:
+    // exactly one of texture and array/layer is set
+    struct LoadJob {
+        Texture *texture;
+        TextureArray *array;
+        TextureLayer *layer;
+        CookedTexture cooked;
+        // created by upload(); the array's own texture for layers
+        GLuint id = 0;
+    };
+
+    JobSystem &jobs;
+    UploadThread &uploads;
+    // deque keeps Texture pointers stable
+    std::deque<Texture> textures;
+    GLuint placeholder = 0;
+    // shared with jobs that may still run after the loader is gone
+    std::shared_ptr<std::atomic<int>> pending;
+
+    void submit(LoadJob job, const std::string &path, bool alpha, bool flip) {
+        (*pending)++;
+        int channels = alpha ? 4 : 3;
+        int width = job.array ? job.array->width : 0;
+        int height = job.array ? job.array->height : 0;
+        // std::function needs a copyable callable, so the job travels by pointer
+        std::shared_ptr<LoadJob> shared = std::make_shared<LoadJob>(std::move(job));
+        UploadThread *upload_thread = &uploads;
+        std::shared_ptr<std::atomic<int>> count = pending;
+        jobs.run([upload_thread, count, shared, path, channels, flip, width, height] {
+            StartupPhase phase("texture", path.c_str());
+            if (!load_cooked_texture(path, channels, flip, shared->cooked, width, height)) {
+                LOG_ERROR("failed to load texture %s", path.c_str());
+                (*count)--;
+                return;
+            }
+            // done runs in collect() on the render thread, while the loader lives
+            upload_thread->submit([shared](UploadContext &context) { upload(*shared, context); },
+                                  [count, shared] {
+                                      finish(*shared);
+                                      (*count)--;
+                                  });
+        });
+    }
+
+    // immutable storage where available, the 3.3 equivalent otherwise
+    static void allocate_storage(int levels, GLenum internal_format, int width, int height) {
+        if (GLAD_GL_VERSION_4_2) {
+            glTexStorage2D(GL_TEXTURE_2D, levels, internal_format, width, height);
+            return;
+        }
+        GLenum format = internal_format == GL_RGB8 ? GL_RGB : GL_RGBA;
+        for (int level = 0; level < levels; level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+
+    // upload thread
+    static void upload(LoadJob &job, UploadContext &context) {
+        TRACE_ZONE("texture upload");
+        const CookedTexture &cooked = job.cooked;
+        const CookedHeader &header = cooked.header;
+        if (job.array) {
+            // the array has storage already; cooking at its size gave the same chain
+            job.id = job.array->id;
+            glBindTexture(GL_TEXTURE_2D_ARRAY, job.id);
+        } else {
+            glGenTextures(1, &job.id);
+            glBindTexture(GL_TEXTURE_2D, job.id);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            allocate_storage(header.levels, header.internal_format, header.width, header.height);
+            GpuMemory::texture(job.id, header.internal_format, header.width, header.height, 1, header.levels,
+                               "texture");
+        }
+        for (int level = 0; level < (int) header.levels; level++)
+            context.texture_level(level, job.array ? job.layer->layer : -1, cooked.level_width(level),
+                                  cooked.level_height(level), header.format, cooked.level(level),
+                                  header.sizes[level]);
+        glBindTexture(job.array ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, 0);
+        // the pixels are in the staging buffer now; drop the mapping
+        job.cooked.view = FileView();
+    }
+
+    // render thread
+    static void finish(LoadJob &job) {
+        if (job.layer) {
+            job.layer->ready = true;
+        } else {
+            job.texture->id = job.id;
+            job.texture->width = job.cooked.header.width;
+            job.texture->height = job.cooked.header.height;
+            job.texture->ready = true;
+        }
+    }
+};
+
+#endif //CG_ASYNC_TEXTURE_LOADER_H
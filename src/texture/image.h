@@ -0,0 +1,60 @@
+#ifndef CG_IMAGE_H
+#define CG_IMAGE_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stb_image/stb_image.h>
+#include "../io/vfs.h"
+#include "../profiling/trace.h"
+
+// Decoded 8-bit image, rows stored top to bottom unless flipped on load.
+struct Image {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+
+    bool empty() const {
+        return pixels.empty();
+    }
+
+    size_t row_size() const {
+        return (size_t) width * channels;
+    }
+};
+
+inline void flip_rows(Image &image) {
+    size_t row = image.row_size();
+    std::vector<unsigned char> tmp(row);
+    unsigned char *top = image.pixels.data();
+    unsigned char *bottom = top + row * (image.height - 1);
+    for (; top < bottom; top += row, bottom -= row) {
+        memcpy(tmp.data(), top, row);
+        memcpy(top, bottom, row);
+        memcpy(bottom, tmp.data(), row);
+    }
+}
+
+// Safe to call from any thread: stbi_set_flip_vertically_on_load is global
+// state in this stb version, so the flip is applied here instead.
+inline bool decode_image(const FileView &file, int channels, bool flip, Image &out) {
+    TRACE_ZONE("decode image");
+    if (!file)
+        return false;
+    int width, height, file_channels;
+    unsigned char *data = stbi_load_from_memory(file.data, (int) file.size, &width, &height, &file_channels,
+                                                channels);
+    if (!data)
+        return false;
+    out.width = width;
+    out.height = height;
+    out.channels = channels;
+    out.pixels.assign(data, data + (size_t) width * height * channels);
+    stbi_image_free(data);
+    if (flip)
+        flip_rows(out);
+    return true;
+}
+
+#endif //CG_IMAGE_H
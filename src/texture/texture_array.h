@@ -0,0 +1,108 @@
+#ifndef CG_TEXTURE_ARRAY_H
+#define CG_TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "../gl/gpu_memory.h"
+
+// Slot in a TextureArray. Layer 0 is the grey placeholder, so index()
+// stays valid for sampling while the real layer is still uploading.
+struct TextureLayer {
+    int layer = 0;
+    bool ready = false;
+    std::string path;
+
+    int index() const {
+        return ready ? layer : 0;
+    }
+};
+
+// Per-material pair of layers, matching the base/overlay samplers the
+// textured shaders used to take as two separate 2D textures.
+struct Material {
+    const TextureLayer *base;
+    const TextureLayer *overlay;
+};
+
+// Fixed-size RGBA8 GL_TEXTURE_2D_ARRAY handing out one layer per texture.
+// Everything sampled from one array needs a single bind for the whole
+// frame, so draws using different textures can share a batch.
+class TextureArray {
+public:
+    GLuint id = 0;
+    const int width;
+    const int height;
+    const int levels;
+    const int capacity;
+
+    TextureArray(int width, int height, int capacity) : width(width),
+                                                        height(height),
+                                                        levels(mip_levels(width, height)),
+                                                        capacity(capacity) {
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (GLAD_GL_VERSION_4_2) {
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, width, height, capacity);
+        } else {
+            for (int level = 0; level < levels; level++)
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(1, width >> level),
+                             std::max(1, height >> level), capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        }
+        std::vector<unsigned char> grey((size_t) width * height * 4, 128);
+        for (int level = 0; level < levels; level++)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, std::max(1, width >> level),
+                            std::max(1, height >> level), 1, GL_RGBA, GL_UNSIGNED_BYTE, grey.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        GpuMemory::texture(id, GL_RGBA8, width, height, capacity, levels, "texture array");
+        layers.emplace_back();
+        layers.back().ready = true;
+    }
+
+    ~TextureArray() {
+        glDeleteTextures(1, &id);
+        GpuMemory::release_texture(id);
+    }
+
+    TextureArray(const TextureArray &) = delete;
+
+    TextureArray &operator=(const TextureArray &) = delete;
+
+    // nullptr once every layer is taken
+    TextureLayer *reserve(const std::string &path) {
+        if ((int) layers.size() == capacity)
+            return nullptr;
+        layers.emplace_back();
+        layers.back().layer = (int) layers.size() - 1;
+        layers.back().path = path;
+        return &layers.back();
+    }
+
+    const TextureLayer *placeholder() const {
+        return &layers.front();
+    }
+
+    int used() const {
+        return (int) layers.size();
+    }
+
+private:
+    // deque keeps TextureLayer pointers stable
+    std::deque<TextureLayer> layers;
+
+    static int mip_levels(int width, int height) {
+        int levels = 1;
+        while ((width | height) >> levels)
+            levels++;
+        return levels;
+    }
+};
+
+#endif //CG_TEXTURE_ARRAY_H
@@ -0,0 +1,335 @@
+#ifndef CG_TEXTURE_COOKER_H
+#define CG_TEXTURE_COOKER_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "image.h"
+#include "../io/mapped_file.h"
+#include "../io/vfs.h"
+#include "../profiling/alloc_tracker.h"
+#include "../log/logger.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+#endif
+
+// Cooked texture container (.ctex): a header followed by every mip level,
+// tightly packed rows, ready to hand to glTexSubImage2D as is.
+const int CTEX_VERSION = 1;
+const int CTEX_MAX_LEVELS = 16;
+
+struct CookedHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t flip;
+    uint32_t internal_format;
+    uint32_t format;
+    uint32_t levels;
+    uint32_t reserved;
+    uint64_t offsets[CTEX_MAX_LEVELS];
+    uint64_t sizes[CTEX_MAX_LEVELS];
+};
+
+// Mip chain viewed in place: a mapped cache file or pack entry, or the
+// freshly cooked bytes.
+struct CookedTexture {
+    CookedHeader header{};
+    FileView view;
+
+    const unsigned char *base() const {
+        return view.data;
+    }
+
+    const unsigned char *level(int i) const {
+        return base() + header.offsets[i];
+    }
+
+    int level_width(int i) const {
+        return std::max(1, (int) header.width >> i);
+    }
+
+    int level_height(int i) const {
+        return std::max(1, (int) header.height >> i);
+    }
+
+    bool empty() const {
+        return header.levels == 0;
+    }
+};
+
+namespace srgb {
+    const int ENCODE_STEPS = 16384;
+
+    struct Tables {
+        float to_linear[256];
+        unsigned char to_srgb[ENCODE_STEPS + 1];
+
+        Tables() {
+            for (int i = 0; i < 256; i++) {
+                float c = i / 255.f;
+                to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i <= ENCODE_STEPS; i++) {
+                float l = (float) i / ENCODE_STEPS;
+                float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1 / 2.4f) - 0.055f;
+                to_srgb[i] = (unsigned char) std::lround(std::min(1.f, c) * 255);
+            }
+        }
+    };
+
+    inline const Tables &tables() {
+        static Tables t;
+        return t;
+    }
+}
+
+// Linear-light RGBA working copy of one level, 4 floats per pixel.
+struct LinearLevel {
+    int width = 0;
+    int height = 0;
+    std::vector<float> texels;
+};
+
+inline void to_linear(const Image &image, LinearLevel &out) {
+    const srgb::Tables &t = srgb::tables();
+    out.width = image.width;
+    out.height = image.height;
+    out.texels.assign((size_t) image.width * image.height * 4, 1.f);
+    const unsigned char *src = image.pixels.data();
+    float *dst = out.texels.data();
+    for (size_t i = 0, n = (size_t) image.width * image.height; i < n; i++, src += image.channels, dst += 4) {
+        dst[0] = t.to_linear[src[0]];
+        dst[1] = t.to_linear[src[1]];
+        dst[2] = t.to_linear[src[2]];
+        if (image.channels == 4)
+            dst[3] = src[3] / 255.f;
+    }
+}
+
+// 2x2 box filter in linear space; odd edges reuse the last row/column.
+inline void downsample(const LinearLevel &src, LinearLevel &dst) {
+    dst.width = std::max(1, src.width / 2);
+    dst.height = std::max(1, src.height / 2);
+    dst.texels.resize((size_t) dst.width * dst.height * 4);
+    const float *in = src.texels.data();
+    float *out = dst.texels.data();
+    for (int y = 0; y < dst.height; y++) {
+        const float *row0 = in + (size_t) std::min(2 * y, src.height - 1) * src.width * 4;
+        const float *row1 = in + (size_t) std::min(2 * y + 1, src.height - 1) * src.width * 4;
+        for (int x = 0; x < dst.width; x++, out += 4) {
+            int x0 = std::min(2 * x, src.width - 1) * 4;
+            int x1 = std::min(2 * x + 1, src.width - 1) * 4;
+#ifdef __SSE2__
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+                                    _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+            _mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+            for (int c = 0; c < 4; c++)
+                out[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+#endif
+        }
+    }
+}
+
+// bilinear resample to an arbitrary size, sampling at texel centers
+inline void resample(const LinearLevel &src, int width, int height, LinearLevel &dst) {
+    dst.width = width;
+    dst.height = height;
+    dst.texels.resize((size_t) width * height * 4);
+    float *out = dst.texels.data();
+    for (int y = 0; y < height; y++) {
+        float fy = std::max(0.f, (y + 0.5f) * src.height / height - 0.5f);
+        int y0 = std::min((int) fy, src.height - 1);
+        int y1 = std::min(y0 + 1, src.height - 1);
+        float ty = fy - y0;
+        for (int x = 0; x < width; x++, out += 4) {
+            float fx = std::max(0.f, (x + 0.5f) * src.width / width - 0.5f);
+            int x0 = std::min((int) fx, src.width - 1);
+            int x1 = std::min(x0 + 1, src.width - 1);
+            float tx = fx - x0;
+            const float *p00 = &src.texels[((size_t) y0 * src.width + x0) * 4];
+            const float *p01 = &src.texels[((size_t) y0 * src.width + x1) * 4];
+            const float *p10 = &src.texels[((size_t) y1 * src.width + x0) * 4];
+            const float *p11 = &src.texels[((size_t) y1 * src.width + x1) * 4];
+            for (int c = 0; c < 4; c++) {
+                float top = p00[c] + (p01[c] - p00[c]) * tx;
+                float bottom = p10[c] + (p11[c] - p10[c]) * tx;
+                out[c] = top + (bottom - top) * ty;
+            }
+        }
+    }
+}
+
+inline void to_srgb(const LinearLevel &level, int channels, unsigned char *out) {
+    const srgb::Tables &t = srgb::tables();
+    const float *in = level.texels.data();
+    for (size_t i = 0, n = (size_t) level.width * level.height; i < n; i++, in += 4, out += channels) {
+        int q[4];
+#ifdef __SSE2__
+        __m128 scale = _mm_set_ps(255.f, srgb::ENCODE_STEPS, srgb::ENCODE_STEPS, srgb::ENCODE_STEPS);
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in), _mm_setzero_ps()), _mm_set1_ps(1.f));
+        _mm_storeu_si128((__m128i *) q, _mm_cvtps_epi32(_mm_mul_ps(v, scale)));
+#else
+        for (int c = 0; c < 4; c++)
+            q[c] = (int) std::lround(std::min(1.f, std::max(0.f, in[c])) * (c == 3 ? 255 : srgb::ENCODE_STEPS));
+#endif
+        out[0] = t.to_srgb[q[0]];
+        out[1] = t.to_srgb[q[1]];
+        out[2] = t.to_srgb[q[2]];
+        if (channels == 4)
+            out[3] = (unsigned char) q[3];
+    }
+}
+
+// Builds the full container for an 8-bit RGB/RGBA image.
+inline void cook_texture(const Image &image, bool flip, std::vector<unsigned char> &out) {
+    TRACE_ZONE("cook texture");
+    CookedHeader header{};
+    memcpy(header.magic, "CTEX", 4);
+    header.version = CTEX_VERSION;
+    header.width = image.width;
+    header.height = image.height;
+    header.channels = image.channels;
+    header.flip = flip;
+    header.internal_format = image.channels == 4 ? GL_RGBA8 : GL_RGB8;
+    header.format = image.channels == 4 ? GL_RGBA : GL_RGB;
+    header.levels = 1;
+    while (header.levels < CTEX_MAX_LEVELS && ((header.width | header.height) >> header.levels))
+        header.levels++;
+
+    size_t offset = sizeof(CookedHeader);
+    for (uint32_t i = 0; i < header.levels; i++) {
+        offset = (offset + 15) & ~(size_t) 15;
+        header.offsets[i] = offset;
+        header.sizes[i] = (size_t) std::max(1, image.width >> i) * std::max(1, image.height >> i) * image.channels;
+        offset += header.sizes[i];
+    }
+    out.assign(offset, 0);
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + header.offsets[0], image.pixels.data(), header.sizes[0]);
+
+    LinearLevel cur, next;
+    to_linear(image, cur);
+    for (uint32_t i = 1; i < header.levels; i++) {
+        downsample(cur, next);
+        to_srgb(next, image.channels, out.data() + header.offsets[i]);
+        std::swap(cur, next);
+    }
+}
+
+// width/height of 0 accept whatever size the container holds
+inline bool parse_cooked(const unsigned char *data, size_t size, int channels, bool flip, int width, int height,
+                         CookedHeader &header) {
+    if (size < sizeof(CookedHeader))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "CTEX", 4) != 0 || header.version != CTEX_VERSION)
+        return false;
+    if ((int) header.channels != channels || header.flip != (uint32_t) flip)
+        return false;
+    if ((width && (int) header.width != width) || (height && (int) header.height != height))
+        return false;
+    if (header.levels == 0 || header.levels > CTEX_MAX_LEVELS)
+        return false;
+    for (uint32_t i = 0; i < header.levels; i++)
+        if (header.offsets[i] + header.sizes[i] > size)
+            return false;
+    return true;
+}
+
+inline bool write_cooked(const std::string &path, const std::vector<unsigned char> &blob) {
+    // write then rename, so a concurrent reader never maps a partial file
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(blob.data(), 1, blob.size(), f) == blob.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline std::string cooked_path(const std::string &source, int width = 0, int height = 0) {
+    if (width && height)
+        return source + "." + std::to_string(width) + "x" + std::to_string(height) + ".ctex";
+    return source + ".ctex";
+}
+
+// Decodes an image file and cooks it into a container; a nonzero width and
+// height resample it to that size first. Shared with tools/cgcook.cpp.
+inline bool cook_image_file(const FileView &file, int channels, bool flip, int width, int height,
+                            std::vector<unsigned char> &blob) {
+    Image image;
+    if (!decode_image(file, channels, flip, image))
+        return false;
+    if (width && height && (image.width != width || image.height != height)) {
+        LinearLevel original, resized;
+        to_linear(image, original);
+        resample(original, width, height, resized);
+        image.width = width;
+        image.height = height;
+        image.pixels.resize((size_t) width * height * channels);
+        to_srgb(resized, channels, image.pixels.data());
+    }
+    cook_texture(image, flip, blob);
+    return true;
+}
+
+// Finds the cooked container for source through the VFS, re-cooking it
+// first when the source is newer or the cache was built with different
+// settings. A nonzero width and height resample the image to that size
+// before cooking. Fresh caches are written to the first loose directory,
+// except for embedded sources, which never touch the disk. Embedded builds
+// carry containers cooked at build time (CG_COOKED_TEXTURES), used as is.
+inline bool load_cooked_texture(const std::string &source, int channels, bool flip, CookedTexture &out,
+                                int width = 0, int height = 0) {
+    TRACE_ZONE("load cooked texture");
+    ALLOC_TAG("texture load");
+    std::string cache = cooked_path(source, width, height);
+    // embedded files never go stale and never touch the disk; sources
+    // without a cooked container are cooked in memory
+    bool embedded_cache = vfs().is_embedded(cache);
+    bool embedded = embedded_cache || vfs().is_embedded(source);
+    long long source_time = embedded ? 0 : vfs().mtime(source);
+    long long cache_time = embedded_cache ? 0 : embedded ? -1 : vfs().mtime(cache);
+    if (cache_time >= 0 && cache_time >= source_time) {
+        FileView view = vfs().read(cache);
+        if (parse_cooked(view.data, view.size, channels, flip, width, height, out.header)) {
+            prefault(view);
+            out.view = std::move(view);
+            return true;
+        }
+    }
+
+    if (embedded_cache)
+        LOG_WARNING("embedded %s does not match how it is loaded, cooking %s", cache.c_str(), source.c_str());
+    std::vector<unsigned char> blob;
+    if (!cook_image_file(vfs().read(source), channels, flip, width, height, blob))
+        return false;
+    std::string cache_file = embedded ? "" : vfs().writable_path(cache);
+    if (!cache_file.empty() && !write_cooked(cache_file, blob))
+        LOG_WARNING("failed to write texture cache %s", cache_file.c_str());
+    std::shared_ptr<std::vector<unsigned char>> memory = std::make_shared<std::vector<unsigned char>>(std::move(blob));
+    out.view.data = memory->data();
+    out.view.size = memory->size();
+    out.view.found = true;
+    out.view.owner = memory;
+    return parse_cooked(out.view.data, out.view.size, channels, flip, width, height, out.header);
+}
+
+#endif //CG_TEXTURE_COOKER_H
@@ -0,0 +1,51 @@
+#ifndef CG_JOB_BENCHMARK_H
+#define CG_JOB_BENCHMARK_H
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "job_system.h"
+
+using namespace glm;
+
+// Scaling of JobSystem from 1 to N threads on an instance packing
+// workload: a transform per item, split with parallel_for.
+inline void run_job_benchmark() {
+    const size_t ITEMS = 1 << 20;
+    const size_t GRAIN = 4096;
+    const int RUNS = 10;
+    std::vector<mat4> out(ITEMS);
+    auto pack = [&out](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            float f = (float) i;
+            mat4 model = translate(mat4(1.f), vec3(sin(f), cos(f), f * 0.001f));
+            out[i] = rotate(model, f * 0.01f, normalize(vec3(1, 1, 0)));
+        }
+    };
+
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    double single = 0;
+    printf("threads     ms/run  speedup  efficiency\n");
+    for (unsigned threads = 1; threads <= max_threads; threads++) {
+        JobSystem jobs(threads - 1);
+        jobs.parallel_for(0, ITEMS, GRAIN, pack);
+        jobs.reset_stats();
+        auto start = std::chrono::steady_clock::now();
+        for (int run = 0; run < RUNS; run++)
+            jobs.parallel_for(0, ITEMS, GRAIN, pack);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / RUNS;
+        if (threads == 1)
+            single = ms;
+        printf("%7u %10.3f %8.2f %10.0f%%\n", threads, ms, single / ms, 100 * single / ms / threads);
+        for (unsigned i = 0; i < jobs.size(); i++) {
+            JobStats stats = jobs.stats(i);
+            printf("        %s %2u: %6llu jobs %6llu steals %9.3f ms idle\n", i == 0 ? "main  " : "worker", i,
+                   (unsigned long long) stats.jobs, (unsigned long long) stats.steals, stats.idle_ms);
+        }
+    }
+}
+
+#endif //CG_JOB_BENCHMARK_H
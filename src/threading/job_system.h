@@ -0,0 +1,408 @@
+#ifndef CG_JOB_SYSTEM_H
+#define CG_JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include "../profiling/trace.h"
+#include "../profiling/alloc_tracker.h"
+
+struct JobCounter;
+
+struct Job {
+    std::function<void()> fn;
+    JobCounter *counter;
+};
+
+// Number of unfinished jobs started with it. Jobs queued with run_after
+// are held here until it drops to zero. Only destroy it after wait()
+// returns on it; the last job may still be releasing it otherwise.
+struct JobCounter {
+    std::atomic<int> pending{0};
+    std::mutex mutex;
+    std::vector<Job *> waiters;
+
+    bool done() const {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// Chase-Lev work-stealing deque of fixed capacity. The owner pushes and
+// pops at the bottom, any thread steals from the top.
+class WorkDeque {
+public:
+    static const int64_t CAPACITY = 4096;
+
+    // owner only; false when full
+    bool push(Job *job) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY)
+            return false;
+        slots[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // owner only, newest first
+    Job *pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Job *job = slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // last job: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // any thread, oldest first
+    Job *steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        Job *job = slots[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Job *> slots[CAPACITY]{};
+};
+
+struct JobStats {
+    uint64_t jobs = 0;
+    uint64_t steals = 0;
+    double idle_ms = 0;
+};
+
+// Work-stealing scheduler. Participant 0 is the thread that created it (the
+// render thread), which only runs jobs while inside wait(); the rest are
+// worker threads. Participants push to their own deque and steal from the
+// others when it runs dry; any other thread submits through a shared
+// injection queue. Jobs must not touch GL: no context is current on the
+// workers.
+class JobSystem {
+public:
+    explicit JobSystem(unsigned workers = default_threads()) : participants(workers + 1) {
+        for (ParticipantPtr &p : participants)
+            p.reset(new_participant());
+        current() = Slot{this, 0};
+        for (unsigned i = 1; i <= workers; i++)
+            threads.emplace_back([this, i] { work(i); });
+    }
+
+    ~JobSystem() {
+        stopping.store(true);
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        sleep_cv.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+        // jobs never run still hold their closures and what those capture;
+        // ones parked in a JobCounter belong to whoever owns the counter
+        for (ParticipantPtr &p : participants)
+            while (Job *job = p->deque.steal())
+                delete job;
+        for (Job *job : injected)
+            delete job;
+        for (Job *job : pool)
+            delete job;
+        if (current().system == this)
+            current() = Slot{};
+    }
+
+    JobSystem(const JobSystem &) = delete;
+
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    void run(std::function<void()> fn, JobCounter *counter = nullptr) {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        enqueue(make_job(std::move(fn), counter));
+    }
+
+    // fn is queued once dependency has no pending jobs left
+    void run_after(JobCounter &dependency, std::function<void()> fn, JobCounter *counter = nullptr) {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        Job *job = make_job(std::move(fn), counter);
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (!dependency.done()) {
+                dependency.waiters.push_back(job);
+                return;
+            }
+        }
+        enqueue(job);
+    }
+
+    // runs other jobs until counter drops to zero
+    void wait(JobCounter &counter) {
+        int self = index();
+        while (!counter.done()) {
+            Job *job = find(self);
+            if (job)
+                execute(job, self);
+            else
+                std::this_thread::yield();
+        }
+        // the job that finished it unlocks last
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+    // fn(first, last) over [begin, end) in chunks of at most grain items
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F fn) {
+        struct Range {
+            F *fn;
+            size_t end;
+            size_t grain;
+        } range{&fn, end, std::max<size_t>(grain, 1)};
+        JobCounter counter;
+        // two words, so std::function keeps it inline instead of on the heap
+        const Range *shared = &range;
+        for (size_t first = begin; first < end; first += range.grain) {
+            run([shared, first] { (*shared->fn)(first, std::min(shared->end, first + shared->grain)); }, &counter);
+        }
+        wait(counter);
+    }
+
+    // workers plus the main thread
+    unsigned size() const {
+        return (unsigned) participants.size();
+    }
+
+    JobStats stats(unsigned participant) const {
+        const Participant &p = *participants[participant];
+        JobStats s;
+        s.jobs = p.jobs.load(std::memory_order_relaxed);
+        s.steals = p.steals.load(std::memory_order_relaxed);
+        s.idle_ms = p.idle_ns.load(std::memory_order_relaxed) / 1e6;
+        return s;
+    }
+
+    void reset_stats() {
+        for (ParticipantPtr &p : participants) {
+            p->jobs.store(0, std::memory_order_relaxed);
+            p->steals.store(0, std::memory_order_relaxed);
+            p->idle_ns.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // leave one core to the thread that creates the system
+    static unsigned default_threads() {
+        unsigned hw = std::thread::hardware_concurrency();
+        return std::max(1u, hw > 1 ? hw - 1 : 1u);
+    }
+
+private:
+    struct alignas(64) Participant {
+        WorkDeque deque;
+        std::atomic<uint64_t> jobs{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> idle_ns{0};
+    };
+
+    struct FreeParticipant {
+        void operator()(Participant *p) const {
+            p->~Participant();
+            free(p);
+        }
+    };
+
+    using ParticipantPtr = std::unique_ptr<Participant, FreeParticipant>;
+
+    struct Slot {
+        JobSystem *system = nullptr;
+        int index = -1;
+    };
+
+    std::vector<ParticipantPtr> participants;
+    std::vector<std::thread> threads;
+    std::mutex inject_mutex;
+    std::deque<Job *> injected;
+    std::atomic<int> injected_count{0};
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<int> sleepers{0};
+    std::atomic<bool> stopping{false};
+    // finished jobs for reuse, so steady submission does not allocate
+    std::mutex pool_mutex;
+    std::vector<Job *> pool;
+
+    // operator new only guarantees 16-byte alignment before C++17, which
+    // would defeat the padding against false sharing
+    static Participant *new_participant() {
+        void *memory = nullptr;
+        if (posix_memalign(&memory, alignof(Participant), sizeof(Participant)) != 0)
+            throw std::bad_alloc();
+        return new(memory) Participant();
+    }
+
+    static Slot &current() {
+        thread_local Slot slot;
+        return slot;
+    }
+
+    // participant index of the calling thread, -1 for outsiders
+    int index() const {
+        return current().system == this ? current().index : -1;
+    }
+
+    static uint32_t random() {
+        thread_local uint32_t state = 2463534242u ^ (uint32_t) std::hash<std::thread::id>()(std::this_thread::get_id());
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    Job *make_job(std::function<void()> fn, JobCounter *counter) {
+        Job *job = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (!pool.empty()) {
+                job = pool.back();
+                pool.pop_back();
+            }
+        }
+        if (!job)
+            job = new Job();
+        job->fn = std::move(fn);
+        job->counter = counter;
+        return job;
+    }
+
+    void recycle(Job *job) {
+        job->fn = nullptr;
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool.push_back(job);
+    }
+
+    void enqueue(Job *job) {
+        int self = index();
+        if (self < 0 || !participants[self]->deque.push(job)) {
+            std::lock_guard<std::mutex> lock(inject_mutex);
+            injected.push_back(job);
+            injected_count.fetch_add(1, std::memory_order_release);
+        }
+        if (sleepers.load(std::memory_order_acquire) > 0)
+            sleep_cv.notify_one();
+    }
+
+    Job *find(int self) {
+        Job *job = self >= 0 ? participants[self]->deque.pop() : nullptr;
+        if (job)
+            return job;
+        if (injected_count.load(std::memory_order_acquire) > 0) {
+            std::lock_guard<std::mutex> lock(inject_mutex);
+            if (!injected.empty()) {
+                job = injected.front();
+                injected.pop_front();
+                injected_count.fetch_sub(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        unsigned n = size();
+        unsigned start = random() % n;
+        for (unsigned i = 0; i < n; i++) {
+            unsigned victim = (start + i) % n;
+            if ((int) victim == self)
+                continue;
+            job = participants[victim]->deque.steal();
+            if (job) {
+                if (self >= 0)
+                    participants[self]->steals.fetch_add(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void execute(Job *job, int self) {
+        {
+            TRACE_ZONE("job");
+            ALLOC_TAG("jobs");
+            job->fn();
+        }
+        if (self >= 0)
+            participants[self]->jobs.fetch_add(1, std::memory_order_relaxed);
+        JobCounter *counter = job->counter;
+        recycle(job);
+        if (counter)
+            finish(*counter);
+    }
+
+    // Only the decrement that may reach zero takes the lock, so waiters
+    // queued by run_after are never missed and wait() cannot return while
+    // the counter is still in use here.
+    void finish(JobCounter &counter) {
+        int pending = counter.pending.load(std::memory_order_relaxed);
+        while (pending > 1)
+            if (counter.pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel))
+                return;
+        std::vector<Job *> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter.mutex);
+            if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                ready.swap(counter.waiters);
+        }
+        for (Job *job : ready)
+            enqueue(job);
+    }
+
+    void work(int self) {
+        current() = Slot{this, self};
+        Trace::name_thread("worker " + std::to_string(self));
+        Participant &me = *participants[self];
+        int misses = 0;
+        while (!stopping.load(std::memory_order_acquire)) {
+            Job *job = find(self);
+            if (job) {
+                misses = 0;
+                execute(job, self);
+                continue;
+            }
+            auto idle_start = std::chrono::steady_clock::now();
+            if (++misses < 64) {
+                std::this_thread::yield();
+            } else {
+                // a submit between our search and the wait is caught by the timeout
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                sleepers.fetch_add(1, std::memory_order_acq_rel);
+                sleep_cv.wait_for(lock, std::chrono::milliseconds(1));
+                sleepers.fetch_sub(1, std::memory_order_acq_rel);
+            }
+            me.idle_ns.fetch_add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - idle_start).count(), std::memory_order_relaxed);
+        }
+    }
+};
+
+#endif //CG_JOB_SYSTEM_H
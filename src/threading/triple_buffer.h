@@ -0,0 +1,47 @@
+#ifndef CG_TRIPLE_BUFFER_H
+#define CG_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free single producer / single consumer handoff of the latest value.
+// The writer fills back() and publish()es it; the reader acquire()s the
+// newest published slot and keeps reading front() until the next acquire.
+// Neither side ever waits for the other; stale values are skipped. Slots
+// are reused, so T's buffers (vectors etc.) stop allocating once warm.
+template<typename T>
+class TripleBuffer {
+public:
+    T &back() {
+        return slots[back_index];
+    }
+
+    // hands back() to the reader and starts a new back slot
+    void publish() {
+        int previous = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+        back_index = previous & INDEX;
+    }
+
+    // true if a newer value was published since the last acquire
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        int previous = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = previous & INDEX;
+        return true;
+    }
+
+    const T &front() const {
+        return slots[front_index];
+    }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    T slots[3];
+    int back_index = 0;
+    std::atomic<int> middle{1};
+    int front_index = 2;
+};
+
+#endif //CG_TRIPLE_BUFFER_H
@@ -0,0 +1,54 @@
+// Cooks an image into the texture container load_cooked_texture reads.
+//   cgcook [-a] [-f] [-s WxH] <source> <out.ctex>
+// -a keeps an alpha channel, -f flips vertically and -s resamples to the
+// given size; these must match how the engine loads the texture, or it
+// cooks the source again at runtime.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../io/mapped_file.h"
+#include "../texture/texture_cooker.h"
+
+int main(int argc, char **argv) {
+    int arg = 1;
+    int channels = 3, width = 0, height = 0;
+    bool flip = false;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-a") == 0)
+            channels = 4;
+        else if (strcmp(argv[arg], "-f") == 0)
+            flip = true;
+        else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc &&
+                 sscanf(argv[arg + 1], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+            arg++;
+        else
+            break;
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [-a] [-f] [-s WxH] <source> <out.ctex>\n", argv[0]);
+        return 1;
+    }
+    std::string source = argv[arg++];
+    std::string out = argv[arg++];
+    MappedFile file(source);
+    if (!file.is_open()) {
+        fprintf(stderr, "failed to read %s\n", source.c_str());
+        return 1;
+    }
+    FileView view;
+    view.data = file.data();
+    view.size = file.size();
+    view.found = true;
+    std::vector<unsigned char> blob;
+    if (!cook_image_file(view, channels, flip, width, height, blob)) {
+        fprintf(stderr, "failed to decode %s\n", source.c_str());
+        return 1;
+    }
+    if (!write_cooked(out, blob)) {
+        fprintf(stderr, "failed to write %s\n", out.c_str());
+        return 1;
+    }
+    printf("%s: %zu bytes\n", out.c_str(), blob.size());
+    return 0;
+}
@@ -0,0 +1,37 @@
+// Builds a pack file for the VFS.
+//   cgpack [-z] <out.pak> <root> <file>...
+// Files are named inside the pack by their path relative to root, the same
+// relative paths the engine asks for ("shaders/3D.vs"). -z stores entries
+// as LZ4 blocks where that pays off.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../io/pack_file.h"
+
+int main(int argc, char **argv) {
+    int arg = 1;
+    bool compress = false;
+    if (arg < argc && strcmp(argv[arg], "-z") == 0) {
+        compress = true;
+        arg++;
+    }
+    if (argc - arg < 2) {
+        fprintf(stderr, "usage: %s [-z] <out.pak> <root> <file>...\n", argv[0]);
+        return 1;
+    }
+    std::string out = argv[arg++];
+    std::string root = argv[arg++];
+    if (!root.empty() && root.back() != '/')
+        root += '/';
+    std::vector<std::pair<std::string, std::string>> files;
+    for (; arg < argc; arg++)
+        files.emplace_back(argv[arg], root + argv[arg]);
+    if (!build_pack(out, files, compress)) {
+        fprintf(stderr, "failed to write %s\n", out.c_str());
+        return 1;
+    }
+    printf("%s: %zu files\n", out.c_str(), files.size());
+    return 0;
+}
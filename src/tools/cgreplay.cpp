@@ -0,0 +1,582 @@
+// Plays back a GL capture written by CG --capture and times every call.
+//   cgreplay [--no-finish] [--top N] <file.cgcap>
+// Everything before the first captured frame is setup (object creation,
+// uploads); the table covers the frames. Each frame ends with glFinish,
+// timed on its own, so the GPU work of one frame does not leak into the
+// next; --no-finish leaves the driver to pipeline frames instead. Contexts
+// are hidden windows sharing objects, one per captured context, so
+// bindings stay apart as in the application; on a GLFW built with OSMesa
+// no display is needed at all.
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../gl/capture_format.h"
+
+using namespace capture;
+
+class Replayer {
+public:
+    struct CallStats {
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+        uint64_t max_ns = 0;
+    };
+
+    struct FrameStats {
+        uint64_t calls = 0;
+        uint64_t gl_ns = 0;
+        uint64_t finish_ns = 0;
+        uint64_t wall_ns = 0;
+    };
+
+    Reader in;
+    bool finish = true;
+    CallStats setup;
+    // per op, frames only
+    CallStats calls[OP_COUNT];
+    std::vector<FrameStats> frames;
+
+    ~Replayer() {
+        for (size_t i = 1; i < contexts.size(); i++)
+            glfwDestroyWindow(contexts[i]);
+    }
+
+    // first context, current on this thread with GLAD loaded
+    bool begin(GLFWwindow *window) {
+        contexts.push_back(window);
+        current_program.push_back(0);
+        return true;
+    }
+
+    // false on a malformed stream
+    bool run() {
+        frame = FrameStats{};
+        frame_start = now();
+        while (!in.done() && !in.failed) {
+            Op op = (Op) in.get<uint8_t>();
+            if (!play(op)) {
+                fprintf(stderr, "unknown record %d at the end of %zu bytes\n", op, in.size());
+                return false;
+            }
+        }
+        return !in.failed;
+    }
+
+    GLuint name(NameKind kind, GLuint recorded) {
+        if (recorded == 0)
+            return 0;
+        auto it = names[kind].find(recorded);
+        return it != names[kind].end() ? it->second : recorded;
+    }
+
+    GLsync sync(uint64_t recorded) {
+        auto it = syncs.find(recorded);
+        return it != syncs.end() ? it->second : nullptr;
+    }
+
+    GLint location(GLint recorded) {
+        if (recorded < 0)
+            return recorded;
+        auto it = locations.find(key(current_program[context], (GLuint) recorded));
+        return it != locations.end() ? it->second : recorded;
+    }
+
+    void *scratch() {
+        static uint64_t memory[1 << 13];
+        return memory;
+    }
+
+private:
+    std::vector<GLFWwindow *> contexts;
+    int context = 0;
+    // recorded program in use, per context
+    std::vector<GLuint> current_program;
+    std::unordered_map<GLuint, GLuint> names[NAME_KINDS];
+    std::unordered_map<uint64_t, GLsync> syncs;
+    // keyed by recorded program and recorded location or block index
+    std::unordered_map<uint64_t, GLint> locations;
+    std::unordered_map<uint64_t, GLuint> blocks;
+    // where each mapped buffer's first byte is, by recorded name
+    std::unordered_map<GLuint, uint8_t *> mapped;
+    FrameStats frame;
+    uint64_t frame_start = 0;
+
+    template<typename Fn, typename RoleList>
+    struct Generic;
+
+    template<typename R, typename... A, typename... Types>
+    struct Generic<R (APIENTRYP)(A...), Roles<Types...>> {
+        static void play(Replayer &replayer, Op op, R (APIENTRYP fn)(A...)) {
+            // a braced list reads the arguments in order
+            std::tuple<A...> args{Types::template read<A>(replayer.in, replayer)...};
+            replayer.time(op, [&] { call(fn, args, std::index_sequence_for<A...>()); });
+        }
+
+        template<size_t... I>
+        static void call(R (APIENTRYP fn)(A...), std::tuple<A...> &args, std::index_sequence<I...>) {
+            fn(std::get<I>(args)...);
+        }
+    };
+
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t key(GLuint program, GLuint value) {
+        return (uint64_t) program << 32 | value;
+    }
+
+    template<typename F>
+    void time(Op op, F call) {
+        uint64_t start = now();
+        call();
+        uint64_t ns = now() - start;
+        CallStats &stats = started ? calls[op] : setup;
+        stats.calls++;
+        stats.ns += ns;
+        stats.max_ns = std::max(stats.max_ns, ns);
+        if (started) {
+            frame.calls++;
+            frame.gl_ns += ns;
+        }
+    }
+
+    // setup until the first frame ends, frames after that
+    bool started = false;
+
+    void end_frame() {
+        if (finish) {
+            uint64_t start = now();
+            glFinish();
+            frame.finish_ns = now() - start;
+        }
+        uint64_t end = now();
+        frame.wall_ns = end - frame_start;
+        if (started)
+            frames.push_back(frame);
+        started = true;
+        frame = FrameStats{};
+        frame_start = end;
+    }
+
+    void switch_context(int index) {
+        if (index == context)
+            return;
+        // what this context did must reach the one that goes on
+        glFlush();
+        while ((int) contexts.size() <= index) {
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            contexts.push_back(glfwCreateWindow(1, 1, "cgreplay", nullptr, contexts[0]));
+            current_program.push_back(0);
+        }
+        glfwMakeContextCurrent(contexts[index]);
+        context = index;
+    }
+
+    void gen(Op op, NameKind kind, void (APIENTRYP fn)(GLsizei, GLuint *)) {
+        GLsizei n = in.get<GLsizei>();
+        uint32_t size;
+        const GLuint *recorded = (const GLuint *) in.payload(size);
+        std::vector<GLuint> created(n);
+        time(op, [&] { fn(n, created.data()); });
+        for (GLsizei i = 0; i < n && recorded; i++)
+            names[kind][recorded[i]] = created[i];
+    }
+
+    void remove(Op op, NameKind kind, void (APIENTRYP fn)(GLsizei, const GLuint *)) {
+        GLsizei n = in.get<GLsizei>();
+        uint32_t size;
+        const GLuint *recorded = (const GLuint *) in.payload(size);
+        std::vector<GLuint> ids(n);
+        for (GLsizei i = 0; i < n && recorded; i++)
+            ids[i] = name(kind, recorded[i]);
+        time(op, [&] { fn(n, ids.data()); });
+        for (GLsizei i = 0; i < n && recorded; i++) {
+            names[kind].erase(recorded[i]);
+            if (kind == BUFFER_NAME)
+                mapped.erase(recorded[i]);
+        }
+    }
+
+    // data that may be absent
+    const void *optional_payload() {
+        if (!in.get<uint8_t>())
+            return nullptr;
+        uint32_t size;
+        return in.payload(size);
+    }
+
+    // pixels of a texture upload: none, a payload or an unpack buffer offset
+    const void *pixels() {
+        uint8_t source = in.get<uint8_t>();
+        if (source == 2)
+            return (const void *) (uintptr_t) in.get<uint64_t>();
+        if (source == 0)
+            return nullptr;
+        uint32_t size;
+        return in.payload(size);
+    }
+
+    bool play(Op op) {
+        switch (op) {
+            case OP_END_FRAME:
+                end_frame();
+                return true;
+            case OP_CONTEXT:
+                switch_context(in.get<uint8_t>());
+                return true;
+            case OP_MAPPED_WRITE: {
+                GLuint buffer = in.get<GLuint>();
+                uint64_t offset = in.get<uint64_t>();
+                uint32_t size;
+                const uint8_t *data = in.payload(size);
+                auto it = mapped.find(buffer);
+                if (it != mapped.end())
+                    time(op, [&] { memcpy(it->second + offset, data, size); });
+                return true;
+            }
+#define CG_UNPAREN(...) __VA_ARGS__
+#define CG_PLAY_GENERIC(name, roles) \
+            case OP_##name: \
+                Generic<decltype(glad_gl##name), Roles<CG_UNPAREN roles>>::play(*this, op, glad_gl##name); \
+                return true;
+            CG_GENERIC_GL_CALLS(CG_PLAY_GENERIC)
+#undef CG_PLAY_GENERIC
+#undef CG_UNPAREN
+            case OP_BindBuffer: {
+                GLenum target = in.get<GLenum>();
+                GLuint buffer = name(BUFFER_NAME, in.get<GLuint>());
+                time(op, [&] { glBindBuffer(target, buffer); });
+                return true;
+            }
+            case OP_BindBufferRange: {
+                GLenum target = in.get<GLenum>();
+                GLuint index = in.get<GLuint>();
+                GLuint buffer = name(BUFFER_NAME, in.get<GLuint>());
+                GLintptr offset = in.get<GLintptr>();
+                GLsizeiptr size = in.get<GLsizeiptr>();
+                time(op, [&] { glBindBufferRange(target, index, buffer, offset, size); });
+                return true;
+            }
+            case OP_BufferData: {
+                GLenum target = in.get<GLenum>();
+                GLsizeiptr size = in.get<GLsizeiptr>();
+                GLenum usage = in.get<GLenum>();
+                const void *data = optional_payload();
+                time(op, [&] { glBufferData(target, size, data, usage); });
+                return true;
+            }
+            case OP_BufferStorage: {
+                GLenum target = in.get<GLenum>();
+                GLsizeiptr size = in.get<GLsizeiptr>();
+                GLbitfield flags = in.get<GLbitfield>();
+                const void *data = optional_payload();
+                time(op, [&] { glBufferStorage(target, size, data, flags); });
+                return true;
+            }
+            case OP_BufferSubData: {
+                GLenum target = in.get<GLenum>();
+                GLintptr offset = in.get<GLintptr>();
+                uint32_t size;
+                const void *data = in.payload(size);
+                time(op, [&] { glBufferSubData(target, offset, size, data); });
+                return true;
+            }
+            case OP_CopyBufferSubData: {
+                GLenum read_target = in.get<GLenum>();
+                GLenum write_target = in.get<GLenum>();
+                GLintptr read_offset = in.get<GLintptr>();
+                GLintptr write_offset = in.get<GLintptr>();
+                GLsizeiptr size = in.get<GLsizeiptr>();
+                time(op, [&] { glCopyBufferSubData(read_target, write_target, read_offset, write_offset, size); });
+                return true;
+            }
+            case OP_CreateProgram: {
+                GLuint program = 0;
+                time(op, [&] { program = glCreateProgram(); });
+                names[PROGRAM_NAME][in.get<GLuint>()] = program;
+                return true;
+            }
+            case OP_CreateShader: {
+                GLenum type = in.get<GLenum>();
+                GLuint shader = 0;
+                time(op, [&] { shader = glCreateShader(type); });
+                names[SHADER_NAME][in.get<GLuint>()] = shader;
+                return true;
+            }
+            case OP_DeleteBuffers:
+                remove(op, BUFFER_NAME, glad_glDeleteBuffers);
+                return true;
+            case OP_DeleteQueries:
+                remove(op, QUERY_NAME, glad_glDeleteQueries);
+                return true;
+            case OP_DeleteTextures:
+                remove(op, TEXTURE_NAME, glad_glDeleteTextures);
+                return true;
+            case OP_DeleteVertexArrays:
+                remove(op, VERTEX_ARRAY_NAME, glad_glDeleteVertexArrays);
+                return true;
+            case OP_FenceSync: {
+                GLenum condition = in.get<GLenum>();
+                GLbitfield flags = in.get<GLbitfield>();
+                GLsync sync = nullptr;
+                time(op, [&] { sync = glFenceSync(condition, flags); });
+                syncs[in.get<uint64_t>()] = sync;
+                return true;
+            }
+            case OP_GenBuffers:
+                gen(op, BUFFER_NAME, glad_glGenBuffers);
+                return true;
+            case OP_GenQueries:
+                gen(op, QUERY_NAME, glad_glGenQueries);
+                return true;
+            case OP_GenTextures:
+                gen(op, TEXTURE_NAME, glad_glGenTextures);
+                return true;
+            case OP_GenVertexArrays:
+                gen(op, VERTEX_ARRAY_NAME, glad_glGenVertexArrays);
+                return true;
+            case OP_GetUniformBlockIndex: {
+                GLuint recorded_program = in.get<GLuint>();
+                GLuint program = name(PROGRAM_NAME, recorded_program);
+                uint32_t size;
+                const char *block = (const char *) in.payload(size);
+                GLuint index = GL_INVALID_INDEX;
+                time(op, [&] { index = glGetUniformBlockIndex(program, block ? block : ""); });
+                blocks[key(recorded_program, in.get<GLuint>())] = index;
+                return true;
+            }
+            case OP_GetUniformLocation: {
+                GLuint recorded_program = in.get<GLuint>();
+                GLuint program = name(PROGRAM_NAME, recorded_program);
+                uint32_t size;
+                const char *uniform = (const char *) in.payload(size);
+                GLint location = -1;
+                time(op, [&] { location = glGetUniformLocation(program, uniform ? uniform : ""); });
+                GLint recorded = in.get<GLint>();
+                if (recorded >= 0)
+                    locations[key(recorded_program, (GLuint) recorded)] = location;
+                return true;
+            }
+            case OP_MapBufferRange: {
+                GLenum target = in.get<GLenum>();
+                GLintptr offset = in.get<GLintptr>();
+                GLsizeiptr length = in.get<GLsizeiptr>();
+                GLbitfield access = in.get<GLbitfield>();
+                GLuint buffer = in.get<GLuint>();
+                void *pointer = nullptr;
+                time(op, [&] { pointer = glMapBufferRange(target, offset, length, access); });
+                if (pointer)
+                    mapped[buffer] = (uint8_t *) pointer - offset;
+                return true;
+            }
+            case OP_PixelStorei: {
+                GLenum pname = in.get<GLenum>();
+                GLint param = in.get<GLint>();
+                time(op, [&] { glPixelStorei(pname, param); });
+                return true;
+            }
+            case OP_ShaderSource: {
+                GLuint shader = name(SHADER_NAME, in.get<GLuint>());
+                GLsizei count = in.get<GLsizei>();
+                std::vector<const GLchar *> strings(count);
+                std::vector<GLint> lengths(count);
+                for (GLsizei i = 0; i < count; i++) {
+                    uint32_t size;
+                    strings[i] = (const GLchar *) in.payload(size);
+                    lengths[i] = (GLint) size;
+                }
+                time(op, [&] { glShaderSource(shader, count, strings.data(), lengths.data()); });
+                return true;
+            }
+            case OP_TexImage2D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>();
+                GLint internal_format = in.get<GLint>();
+                GLsizei width = in.get<GLsizei>();
+                GLsizei height = in.get<GLsizei>();
+                GLint border = in.get<GLint>();
+                GLenum format = in.get<GLenum>();
+                GLenum type = in.get<GLenum>();
+                const void *data = pixels();
+                time(op, [&] {
+                    glTexImage2D(target, level, internal_format, width, height, border, format, type, data);
+                });
+                return true;
+            }
+            case OP_TexImage3D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>();
+                GLint internal_format = in.get<GLint>();
+                GLsizei width = in.get<GLsizei>();
+                GLsizei height = in.get<GLsizei>();
+                GLsizei depth = in.get<GLsizei>();
+                GLint border = in.get<GLint>();
+                GLenum format = in.get<GLenum>();
+                GLenum type = in.get<GLenum>();
+                const void *data = pixels();
+                time(op, [&] {
+                    glTexImage3D(target, level, internal_format, width, height, depth, border, format, type, data);
+                });
+                return true;
+            }
+            case OP_TexSubImage2D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>();
+                GLint x = in.get<GLint>();
+                GLint y = in.get<GLint>();
+                GLsizei width = in.get<GLsizei>();
+                GLsizei height = in.get<GLsizei>();
+                GLenum format = in.get<GLenum>();
+                GLenum type = in.get<GLenum>();
+                const void *data = pixels();
+                time(op, [&] { glTexSubImage2D(target, level, x, y, width, height, format, type, data); });
+                return true;
+            }
+            case OP_TexSubImage3D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>();
+                GLint x = in.get<GLint>();
+                GLint y = in.get<GLint>();
+                GLint z = in.get<GLint>();
+                GLsizei width = in.get<GLsizei>();
+                GLsizei height = in.get<GLsizei>();
+                GLsizei depth = in.get<GLsizei>();
+                GLenum format = in.get<GLenum>();
+                GLenum type = in.get<GLenum>();
+                const void *data = pixels();
+                time(op, [&] {
+                    glTexSubImage3D(target, level, x, y, z, width, height, depth, format, type, data);
+                });
+                return true;
+            }
+            case OP_UniformBlockBinding: {
+                GLuint recorded_program = in.get<GLuint>();
+                GLuint recorded_index = in.get<GLuint>();
+                GLuint binding = in.get<GLuint>();
+                GLuint program = name(PROGRAM_NAME, recorded_program);
+                auto it = blocks.find(key(recorded_program, recorded_index));
+                GLuint index = it != blocks.end() ? it->second : recorded_index;
+                time(op, [&] { glUniformBlockBinding(program, index, binding); });
+                return true;
+            }
+            case OP_UniformMatrix4fv: {
+                GLint location = this->location(in.get<GLint>());
+                GLboolean transpose = in.get<GLboolean>();
+                uint32_t size;
+                const GLfloat *value = (const GLfloat *) in.payload(size);
+                GLsizei count = (GLsizei) (size / (16 * sizeof(GLfloat)));
+                time(op, [&] { glUniformMatrix4fv(location, count, transpose, value); });
+                return true;
+            }
+            case OP_UseProgram: {
+                GLuint recorded = in.get<GLuint>();
+                GLuint program = name(PROGRAM_NAME, recorded);
+                current_program[context] = recorded;
+                time(op, [&] { glUseProgram(program); });
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+};
+
+static void print(const Replayer &replayer, int top) {
+    const std::vector<Replayer::FrameStats> &frames = replayer.frames;
+    printf("setup: %llu calls, %.2f ms in GL\n", (unsigned long long) replayer.setup.calls, replayer.setup.ns / 1e6);
+    if (frames.empty()) {
+        printf("no complete frames in the capture\n");
+        return;
+    }
+    printf("frame    calls    gl ms  finish ms   wall ms\n");
+    Replayer::FrameStats total;
+    for (size_t i = 0; i < frames.size(); i++) {
+        const Replayer::FrameStats &f = frames[i];
+        printf("%5zu %8llu %8.3f %10.3f %9.3f\n", i, (unsigned long long) f.calls, f.gl_ns / 1e6, f.finish_ns / 1e6,
+               f.wall_ns / 1e6);
+        total.gl_ns += f.gl_ns;
+        total.finish_ns += f.finish_ns;
+        total.wall_ns += f.wall_ns;
+    }
+    size_t n = frames.size();
+    printf(" mean %8s %8.3f %10.3f %9.3f\n", "", total.gl_ns / 1e6 / n, total.finish_ns / 1e6 / n,
+           total.wall_ns / 1e6 / n);
+
+    std::vector<int> ops;
+    for (int op = 0; op < OP_COUNT; op++)
+        if (replayer.calls[op].calls)
+            ops.push_back(op);
+    std::sort(ops.begin(), ops.end(), [&](int a, int b) {
+        return replayer.calls[a].ns > replayer.calls[b].ns;
+    });
+    if ((int) ops.size() > top)
+        ops.resize(top);
+    printf("\n%-28s %8s %10s %9s %9s  (per frame)\n", "call", "calls", "total ms", "mean us", "max us");
+    for (int op : ops) {
+        const Replayer::CallStats &c = replayer.calls[op];
+        printf("%-28s %8.1f %10.3f %9.2f %9.2f\n", op_name(op), (double) c.calls / n, c.ns / 1e6 / n,
+               c.ns / 1e3 / c.calls, c.max_ns / 1e3);
+    }
+}
+
+int main(int argc, char **argv) {
+    Replayer replayer;
+    int top = 20;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-finish") == 0)
+            replayer.finish = false;
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+            top = atoi(argv[++i]);
+        else if (!path && argv[i][0] != '-')
+            path = argv[i];
+        else
+            path = nullptr, i = argc;
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--no-finish] [--top N] <file.cgcap>\n", argv[0]);
+        return 1;
+    }
+    if (!replayer.in.open(path)) {
+        fprintf(stderr, "cannot read capture %s\n", path);
+        return 1;
+    }
+    if (!glfwInit()) {
+        fprintf(stderr, "cannot initialize GLFW\n");
+        return 1;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window = glfwCreateWindow(1, 1, "cgreplay", nullptr, nullptr);
+    if (!window) {
+        fprintf(stderr, "cannot create a GL context\n");
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+        fprintf(stderr, "cannot load GL\n");
+        glfwTerminate();
+        return 1;
+    }
+    printf("%s: %.1f MB of records, %s\n", path, replayer.in.size() / 1048576.0, glGetString(GL_RENDERER));
+    replayer.begin(window);
+    bool ok = replayer.run();
+    print(replayer, top);
+    glfwTerminate();
+    if (!ok)
+        fprintf(stderr, "capture is truncated or corrupt; results cover what was replayed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,2 @@
+#define NK_IMPLEMENTATION
+#include "nuklear_config.h"
@@ -0,0 +1,16 @@
+#ifndef CG_NUKLEAR_CONFIG_H
+#define CG_NUKLEAR_CONFIG_H
+
+// Nuklear as bundled with GLFW, with the same options in every file that
+// includes it; the implementation is compiled once in nuklear.cpp.
+#define NK_INCLUDE_FIXED_TYPES
+#define NK_INCLUDE_STANDARD_IO
+#define NK_INCLUDE_STANDARD_VARARGS
+#define NK_INCLUDE_DEFAULT_ALLOCATOR
+#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
+#define NK_INCLUDE_FONT_BAKING
+#define NK_INCLUDE_DEFAULT_FONT
+
+#include <glfw/deps/nuklear.h>
+
+#endif //CG_NUKLEAR_CONFIG_H
@@ -0,0 +1,236 @@
+#ifndef CG_OVERLAY_H
+#define CG_OVERLAY_H
+
+#include <atomic>
+#include <mutex>
+#include "nuklear_config.h"
+#include "overlay_renderer.h"
+#include "../frame_packet.h"
+#include "../gl/gpu_timer.h"
+#include "../profiling/alloc_tracker.h"
+#include "../profiling/counters.h"
+#include "../profiling/trace.h"
+
+// Mouse input for the overlay. GLFW callbacks on the event thread queue
+// it here while the overlay is visible; the render thread hands it to
+// nuklear at the start of the next overlay frame.
+class OverlayInput {
+public:
+    // toggled on the event thread, read by both
+    std::atomic<bool> visible{false};
+
+    void mouse_move(double x, double y) {
+        std::lock_guard<std::mutex> lock(mutex);
+        mouse_x = x;
+        mouse_y = y;
+    }
+
+    void mouse_button(int button, bool down) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (count < MAX_BUTTON_EVENTS)
+            buttons[count++] = Button{button, down, mouse_x, mouse_y};
+    }
+
+    void scroll(double y) {
+        std::lock_guard<std::mutex> lock(mutex);
+        scroll_y += (float) y;
+    }
+
+    // render thread, between nk_input_begin and nk_input_end
+    void feed(nk_context *ctx) {
+        std::lock_guard<std::mutex> lock(mutex);
+        nk_input_motion(ctx, (int) mouse_x, (int) mouse_y);
+        for (int i = 0; i < count; i++) {
+            const Button &b = buttons[i];
+            nk_buttons button = b.button == GLFW_MOUSE_BUTTON_RIGHT ? NK_BUTTON_RIGHT
+                                : b.button == GLFW_MOUSE_BUTTON_MIDDLE ? NK_BUTTON_MIDDLE : NK_BUTTON_LEFT;
+            nk_input_button(ctx, button, (int) b.x, (int) b.y, b.down);
+        }
+        if (scroll_y != 0)
+            nk_input_scroll(ctx, nk_vec2(0, scroll_y));
+        count = 0;
+        scroll_y = 0;
+    }
+
+private:
+    static const int MAX_BUTTON_EVENTS = 16;
+
+    struct Button {
+        int button;
+        bool down;
+        double x, y;
+    };
+
+    std::mutex mutex;
+    double mouse_x = 0, mouse_y = 0;
+    float scroll_y = 0;
+    Button buttons[MAX_BUTTON_EVENTS];
+    int count = 0;
+};
+
+// Toggles the overlay shows besides the scene parameters.
+struct OverlayToggles {
+    bool draw_scene;
+    bool draw_points;
+};
+
+// Profiler and tuning panel drawn over the scene: frame time graph,
+// per-frame counters, GPU pass times and allocations, plus sliders for the
+// scene parameters. Its own CPU time (building and drawing the UI) is
+// measured and shown next frame; its GPU time shows up as a GPU zone when
+// the caller wraps render() in one. GL thread only.
+class Overlay {
+public:
+    // frames of frame time in the graph
+    static const int GRAPH_FRAMES = 120;
+    // counters are averaged over this many frames, so they stay readable
+    static const int AVERAGE_FRAMES = 60;
+
+    Overlay() {
+        nk_font_atlas_init_default(&atlas);
+        nk_font_atlas_begin(&atlas);
+        nk_font *font = nk_font_atlas_add_default(&atlas, 13, nullptr);
+        int width, height;
+        const void *pixels = nk_font_atlas_bake(&atlas, &width, &height, NK_FONT_ATLAS_RGBA32);
+        nk_draw_null_texture null_texture;
+        nk_font_atlas_end(&atlas, nk_handle_id((int) renderer.upload_font(pixels, width, height)), &null_texture);
+        renderer.set_null_texture(null_texture);
+        nk_init_default(&ctx, &font->handle);
+        ctx.style.window.fixed_background = nk_style_item_color(nk_rgba(30, 30, 30, 200));
+    }
+
+    ~Overlay() {
+        nk_free(&ctx);
+        nk_font_atlas_clear(&atlas);
+    }
+
+    Overlay(const Overlay &) = delete;
+
+    Overlay &operator=(const Overlay &) = delete;
+
+    void set_shader(const Shader &shader) {
+        renderer.set_shader(shader);
+    }
+
+    // Lays out the panel for this frame from input. params and toggles
+    // come in as currently published and go out as edited; returns true if
+    // the user changed any of them.
+    bool build(OverlayInput &input, const GpuTimer &gpu, const AllocMonitor &allocs, SceneParams &params,
+               OverlayToggles &toggles) {
+        TRACE_ZONE("overlay build");
+        build_start = Trace::now();
+        nk_input_begin(&ctx);
+        input.feed(&ctx);
+        nk_input_end(&ctx);
+
+        SceneParams before = params;
+        OverlayToggles toggles_before = toggles;
+        if (nk_begin(&ctx, "profiler", nk_rect(10, 10, 300, 560),
+                     NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_MINIMIZABLE |
+                     NK_WINDOW_TITLE)) {
+            frame_graph();
+            counters();
+            gpu_times(gpu);
+            allocations(allocs);
+            tuning(params, toggles);
+        }
+        nk_end(&ctx);
+        return params.hex_radius != before.hex_radius || params.hex_period != before.hex_period
+               || params.hex_divisions != before.hex_divisions || params.hex_elapsed != before.hex_elapsed
+               || params.stress_cubes != before.stress_cubes || toggles.draw_scene != toggles_before.draw_scene
+               || toggles.draw_points != toggles_before.draw_points;
+    }
+
+    // after build(), in the same frame
+    void render(GLStateCache &cache, int width, int height) {
+        renderer.render(&ctx, cache, width, height);
+        cost_ms = (Trace::now() - build_start) / 1e6;
+    }
+
+private:
+    nk_context ctx;
+    nk_font_atlas atlas;
+    OverlayRenderer renderer;
+    uint64_t build_start = 0;
+    // CPU ms of the last build() and render()
+    double cost_ms = 0;
+
+    void frame_graph() {
+        float max_ms = 1;
+        int frames = (int) std::min<uint64_t>(GRAPH_FRAMES, Counters::frames());
+        for (int back = 0; back < frames; back++)
+            max_ms = std::max(max_ms, (float) Counters::frame_ms(back));
+        nk_layout_row_dynamic(&ctx, 16, 1);
+        nk_labelf(&ctx, NK_TEXT_LEFT, "frame %.2f ms, graph up to %.1f ms", Counters::frame_ms(), max_ms);
+        nk_layout_row_dynamic(&ctx, 60, 1);
+        if (nk_chart_begin(&ctx, NK_CHART_LINES, GRAPH_FRAMES, 0, max_ms)) {
+            // oldest on the left
+            for (int back = GRAPH_FRAMES - 1; back >= 0; back--)
+                nk_chart_push(&ctx, back < frames ? (float) Counters::frame_ms(back) : 0);
+            nk_chart_end(&ctx);
+        }
+    }
+
+    void counters() {
+        if (!nk_tree_push(&ctx, NK_TREE_TAB, "counters / frame", NK_MAXIMIZED))
+            return;
+        nk_layout_row_dynamic(&ctx, 14, 2);
+        for (int i = 0, n = Counters::count(); i < n; i++) {
+            nk_label(&ctx, Counters::name(i), NK_TEXT_LEFT);
+            nk_labelf(&ctx, NK_TEXT_RIGHT, "%.0f", Counters::average(i, AVERAGE_FRAMES));
+        }
+        nk_tree_pop(&ctx);
+    }
+
+    void gpu_times(const GpuTimer &gpu) {
+        if (!nk_tree_push(&ctx, NK_TREE_TAB, "gpu ms", NK_MAXIMIZED))
+            return;
+        nk_layout_row_dynamic(&ctx, 14, 2);
+        for (int i = 0; i < gpu.zone_count(); i++) {
+            nk_label(&ctx, gpu.zone_name(i), NK_TEXT_LEFT);
+            nk_labelf(&ctx, NK_TEXT_RIGHT, "%.3f", gpu.average(i));
+        }
+        nk_label(&ctx, "overlay cpu", NK_TEXT_LEFT);
+        nk_labelf(&ctx, NK_TEXT_RIGHT, "%.3f", cost_ms);
+        nk_tree_pop(&ctx);
+    }
+
+    void allocations(const AllocMonitor &allocs) {
+        if (!nk_tree_push(&ctx, NK_TREE_TAB, "allocations / frame", NK_MINIMIZED))
+            return;
+        if (!alloc_tracker::enabled()) {
+            nk_layout_row_dynamic(&ctx, 14, 1);
+            nk_label(&ctx, "build with CG_TRACK_ALLOCS", NK_TEXT_LEFT);
+        } else {
+            const AllocStats &last = allocs.last_frame();
+            nk_layout_row_dynamic(&ctx, 14, 2);
+            nk_label(&ctx, "new", NK_TEXT_LEFT);
+            nk_labelf(&ctx, NK_TEXT_RIGHT, "%llu (%llu B)", (unsigned long long) last.news,
+                      (unsigned long long) last.new_bytes);
+            nk_label(&ctx, "malloc", NK_TEXT_LEFT);
+            nk_labelf(&ctx, NK_TEXT_RIGHT, "%llu (%llu B)", (unsigned long long) last.mallocs,
+                      (unsigned long long) last.malloc_bytes);
+        }
+        nk_tree_pop(&ctx);
+    }
+
+    void tuning(SceneParams &params, OverlayToggles &toggles) {
+        if (!nk_tree_push(&ctx, NK_TREE_TAB, "scene", NK_MAXIMIZED))
+            return;
+        nk_layout_row_dynamic(&ctx, 20, 1);
+        nk_property_float(&ctx, "#tile radius", 0.05f, &params.hex_radius, 1, 0.01f, 0.002f);
+        nk_property_float(&ctx, "#ring period", 0.2f, &params.hex_period, 10, 0.05f, 0.01f);
+        nk_property_int(&ctx, "#divisions", 1, &params.hex_divisions, 12, 1, 0.1f);
+        nk_property_float(&ctx, "#elapsed", 0, &params.hex_elapsed, 1000, 1, 0.05f);
+        nk_property_int(&ctx, "#stress cubes", 0, &params.stress_cubes, 100000, 100, 20);
+        nk_layout_row_dynamic(&ctx, 20, 2);
+        int scene = toggles.draw_scene, points = toggles.draw_points;
+        nk_checkbox_label(&ctx, "scene", &scene);
+        nk_checkbox_label(&ctx, "points", &points);
+        toggles.draw_scene = scene != 0;
+        toggles.draw_points = points != 0;
+        nk_tree_pop(&ctx);
+    }
+};
+
+#endif //CG_OVERLAY_H
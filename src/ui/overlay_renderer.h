@@ -0,0 +1,182 @@
+#ifndef CG_OVERLAY_RENDERER_H
+#define CG_OVERLAY_RENDERER_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+#include "nuklear_config.h"
+#include "../shader.h"
+#include "../gl/gpu_memory.h"
+#include "../gl/state_cache.h"
+#include "../profiling/counters.h"
+#include "../profiling/trace.h"
+#include "../log/logger.h"
+
+// Draws a nuklear frame on a 3.3 core context in a single glDrawElements.
+// nuklear emits one command per clip rect and expects a scissor change
+// between them; here every vertex carries the clip rect of its command
+// instead and the fragment shader discards outside it, so the whole UI is
+// one batch. All commands sample the font atlas (shapes use its white
+// pixel), so one texture covers them. Vertex and index memory is
+// allocated once. GL thread only.
+class OverlayRenderer {
+public:
+    // nuklear indices are 16 bit
+    static const int MAX_VERTICES = 1 << 16;
+    static const int MAX_INDICES = 3 * MAX_VERTICES;
+    static const GLuint FONT_UNIT = 1;
+
+    OverlayRenderer() : vertices(MAX_VERTICES), indices(MAX_INDICES) {
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, uv));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void *) offsetof(Vertex, color));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, clip));
+        glEnableVertexAttribArray(3);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        nk_buffer_init_default(&commands);
+    }
+
+    ~OverlayRenderer() {
+        nk_buffer_free(&commands);
+        glDeleteTextures(1, &font);
+        glDeleteBuffers(1, &ebo);
+        glDeleteBuffers(1, &vbo);
+        GpuMemory::release_texture(font);
+        GpuMemory::release_buffer(ebo);
+        GpuMemory::release_buffer(vbo);
+        glDeleteVertexArrays(1, &vao);
+    }
+
+    OverlayRenderer(const OverlayRenderer &) = delete;
+
+    OverlayRenderer &operator=(const OverlayRenderer &) = delete;
+
+    // baked RGBA32 atlas; the handle goes to nk_font_atlas_end
+    GLuint upload_font(const void *pixels, int width, int height) {
+        glGenTextures(1, &font);
+        glActiveTexture(GL_TEXTURE0 + FONT_UNIT);
+        glBindTexture(GL_TEXTURE_2D, font);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        GpuMemory::texture(font, GL_RGBA8, width, height, 1, 1, "overlay font");
+        glActiveTexture(GL_TEXTURE0);
+        Counters::add(Counters::TEXTURE_BYTES, 4 * width * height);
+        return font;
+    }
+
+    // call again after the shader is reloaded; leaves it in use
+    void set_shader(const Shader &shader) {
+        program = shader.ID;
+        screen = glGetUniformLocation(program, "screen");
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "font"), FONT_UNIT);
+    }
+
+    void set_null_texture(const nk_draw_null_texture &texture) {
+        null_texture = texture;
+    }
+
+    // converts and draws everything ctx recorded this frame, then clears it
+    void render(nk_context *ctx, GLStateCache &cache, int width, int height) {
+        TRACE_ZONE("overlay render");
+        static const nk_draw_vertex_layout_element layout[] = {
+                {NK_VERTEX_POSITION, NK_FORMAT_FLOAT, offsetof(Vertex, position)},
+                {NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, offsetof(Vertex, uv)},
+                {NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, offsetof(Vertex, color)},
+                {NK_VERTEX_LAYOUT_END}
+        };
+        nk_convert_config config{};
+        config.vertex_layout = layout;
+        config.vertex_size = sizeof(Vertex);
+        config.vertex_alignment = NK_ALIGNOF(Vertex);
+        config.null = null_texture;
+        config.circle_segment_count = 22;
+        config.curve_segment_count = 22;
+        config.arc_segment_count = 22;
+        config.global_alpha = 1.0f;
+        config.shape_AA = NK_ANTI_ALIASING_ON;
+        config.line_AA = NK_ANTI_ALIASING_ON;
+
+        nk_buffer vertex_buffer, index_buffer;
+        nk_buffer_init_fixed(&vertex_buffer, vertices.data(), vertices.size() * sizeof(Vertex));
+        nk_buffer_init_fixed(&index_buffer, indices.data(), indices.size() * sizeof(nk_draw_index));
+        if (nk_convert(ctx, &commands, &vertex_buffer, &index_buffer, &config) != NK_CONVERT_SUCCESS && !overflowed) {
+            LOG_WARNING("overlay: vertex or index buffer full, part of the UI is not drawn");
+            overflowed = true;
+        }
+        // each command's clip rect onto the vertices it uses
+        size_t count = 0;
+        const nk_draw_command *command;
+        nk_draw_foreach(command, ctx, &commands) {
+            const struct nk_rect &r = command->clip_rect;
+            for (size_t i = count; i < count + command->elem_count; i++) {
+                float *clip = vertices[indices[i]].clip;
+                clip[0] = r.x;
+                clip[1] = r.y;
+                clip[2] = r.w;
+                clip[3] = r.h;
+            }
+            count += command->elem_count;
+        }
+        size_t vertex_bytes = nk_buffer_total(&vertex_buffer);
+
+        if (count > 0) {
+            cache.use_program(program);
+            cache.bind_vertex_array(vao);
+            cache.bind_texture(FONT_UNIT, GL_TEXTURE_2D, font);
+            cache.set_polygon_mode(GL_FILL);
+            cache.set_enabled(GL_DEPTH_TEST, false);
+            cache.set_enabled(GL_BLEND, true);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glUniform2f(screen, (float) width, (float) height);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferData(GL_ARRAY_BUFFER, vertex_bytes, vertices.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(nk_draw_index), indices.data(), GL_STREAM_DRAW);
+            GpuMemory::buffer(vbo, vertex_bytes, GL_STREAM_DRAW, "overlay");
+            GpuMemory::buffer(ebo, count * sizeof(nk_draw_index), GL_STREAM_DRAW, "overlay");
+            glDrawElements(GL_TRIANGLES, (GLsizei) count, GL_UNSIGNED_SHORT, 0);
+            // the scene draws with depth testing and without blending
+            cache.set_enabled(GL_BLEND, false);
+            cache.set_enabled(GL_DEPTH_TEST, true);
+            Counters::add(Counters::DRAW_CALLS);
+            Counters::add(Counters::TRIANGLES, count / 3);
+            Counters::add(Counters::UNIFORM_BYTES, 2 * sizeof(float));
+            Counters::add(Counters::BUFFER_BYTES, vertex_bytes + count * sizeof(nk_draw_index));
+        }
+        nk_clear(ctx);
+        nk_buffer_clear(&commands);
+    }
+
+private:
+    struct Vertex {
+        float position[2];
+        float uv[2];
+        nk_byte color[4];
+        // filled in after nk_convert
+        float clip[4];
+    };
+
+    GLuint vao = 0, vbo = 0, ebo = 0, font = 0;
+    GLuint program = 0;
+    GLint screen = -1;
+    nk_draw_null_texture null_texture{};
+    nk_buffer commands;
+    std::vector<Vertex> vertices;
+    std::vector<nk_draw_index> indices;
+    bool overflowed = false;
+};
+
+#endif //CG_OVERLAY_RENDERER_H